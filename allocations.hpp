@@ -0,0 +1,197 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdlib>
+#include <experimental/source_location>
+#include <functional>
+#include <new>
+
+#include "asserts.hpp"
+#include "config.hpp"
+
+namespace testing {
+
+// Allocations made through operator new, and the bytes they requested
+struct AllocationCounts {
+  size_t count = 0;
+  size_t bytes = 0;
+};
+
+namespace detail {
+
+// Counts of this thread's allocations since it started. They're only
+// incremented once TESTING_DEFINE_ALLOCATION_TRACKER replaced operator new.
+inline AllocationCounts &allocation_counts() {
+  thread_local AllocationCounts counts;
+  return counts;
+}
+
+// Set by TESTING_DEFINE_ALLOCATION_TRACKER before main() runs
+inline bool &allocation_tracker_installed() {
+  static bool installed = false;
+  return installed;
+}
+
+inline AllocationCounts allocations_since(const AllocationCounts &start) {
+  const auto &now = allocation_counts();
+  return {now.count - start.count, now.bytes - start.bytes};
+}
+
+// Null if the allocation failed
+inline void *tracked_allocate(size_t size, size_t alignment) noexcept {
+  auto &counts = allocation_counts();
+  ++counts.count;
+  counts.bytes += size;
+
+  // Neither may be asked for 0 bytes, and aligned_alloc only takes multiples
+  // of the alignment
+  const size_t rounded = size == 0 ? 1 : size;
+  if (alignment <= alignof(std::max_align_t)) {
+    return std::malloc(rounded); // NOLINT: Implements operator new
+  }
+  return std::aligned_alloc( // NOLINT: Implements operator new
+      alignment, (rounded + alignment - 1) / alignment * alignment);
+}
+
+// Same, but like operator new, it calls the new-handler until the allocation
+// succeeds or there is none, and then throws std::bad_alloc
+inline void *tracked_new(size_t size, size_t alignment) {
+  while (true) {
+    if (void *memory = tracked_allocate(size, alignment)) {
+      return memory;
+    }
+    if (const auto handler = std::get_new_handler()) {
+      handler();
+    } else {
+#ifdef __cpp_exceptions
+      throw std::bad_alloc{};
+#else
+      std::abort();
+#endif
+    }
+  }
+}
+
+inline void tracked_delete(void *memory) noexcept {
+  std::free(memory); // NOLINT: Implements operator delete
+}
+
+} // namespace detail
+
+// Fails if fn, on this thread, allocates more often than max. Allocations of
+// other threads, e.g. a pool fn submits to, aren't counted. Needs
+// TESTING_DEFINE_ALLOCATION_TRACKER.
+template <typename Fn>
+requires std::invocable<Fn &>
+void assert_max_allocations(size_t max, Fn &&fn,
+                            const std::experimental::source_location location =
+                                std::experimental::source_location::current()) {
+  detail::note_assert(location);
+  if (not detail::allocation_tracker_installed()) {
+    detail::fail(location,
+                 "ERROR: Allocations aren't tracked. Add "
+                 "TESTING_DEFINE_ALLOCATION_TRACKER() to one source file.");
+    return;
+  }
+
+  const auto start = detail::allocation_counts();
+  std::invoke(fn);
+  const auto made = detail::allocations_since(start);
+  if (made.count > max) {
+    detail::fail_with(location,
+                      "ASSERT: Expected at most {} allocations, but there "
+                      "were {} of {} bytes",
+                      max, made.count, made.bytes);
+  }
+}
+
+// Same for an allocation-free fn
+template <typename Fn>
+requires std::invocable<Fn &>
+void assert_no_allocations(Fn &&fn,
+                           const std::experimental::source_location location =
+                               std::experimental::source_location::current()) {
+  assert_max_allocations(0, std::forward<Fn>(fn), location);
+}
+
+} // namespace testing
+
+// Replaces the global operator new and delete with ones that count every
+// allocation of a thread, so the report lists the allocations of every test
+// and assert_max_allocations works. Must be used in exactly one source file
+// of the program, outside of any namespace.
+#define TESTING_DEFINE_ALLOCATION_TRACKER()                                    \
+  [[maybe_unused]] static const bool testing_allocation_tracker =              \
+      (testing::detail::allocation_tracker_installed() = true);                \
+  void *operator new(std::size_t size) {                                       \
+    return testing::detail::tracked_new(size, alignof(std::max_align_t));      \
+  }                                                                            \
+  void *operator new[](std::size_t size) {                                     \
+    return testing::detail::tracked_new(size, alignof(std::max_align_t));      \
+  }                                                                            \
+  void *operator new(std::size_t size, std::align_val_t alignment) {           \
+    return testing::detail::tracked_new(size,                                  \
+                                        static_cast<std::size_t>(alignment));  \
+  }                                                                            \
+  void *operator new[](std::size_t size, std::align_val_t alignment) {         \
+    return testing::detail::tracked_new(size,                                  \
+                                        static_cast<std::size_t>(alignment));  \
+  }                                                                            \
+  void *operator new(std::size_t size, const std::nothrow_t &) noexcept {      \
+    return testing::detail::tracked_allocate(size,                             \
+                                             alignof(std::max_align_t));       \
+  }                                                                            \
+  void *operator new[](std::size_t size, const std::nothrow_t &) noexcept {    \
+    return testing::detail::tracked_allocate(size,                             \
+                                             alignof(std::max_align_t));       \
+  }                                                                            \
+  void *operator new(std::size_t size, std::align_val_t alignment,             \
+                     const std::nothrow_t &) noexcept {                        \
+    return testing::detail::tracked_allocate(                                  \
+        size, static_cast<std::size_t>(alignment));                            \
+  }                                                                            \
+  void *operator new[](std::size_t size, std::align_val_t alignment,           \
+                       const std::nothrow_t &) noexcept {                      \
+    return testing::detail::tracked_allocate(                                  \
+        size, static_cast<std::size_t>(alignment));                            \
+  }                                                                            \
+  void operator delete(void *memory) noexcept {                                \
+    testing::detail::tracked_delete(memory);                                   \
+  }                                                                            \
+  void operator delete[](void *memory) noexcept {                              \
+    testing::detail::tracked_delete(memory);                                   \
+  }                                                                            \
+  void operator delete(void *memory, std::size_t) noexcept {                   \
+    testing::detail::tracked_delete(memory);                                   \
+  }                                                                            \
+  void operator delete[](void *memory, std::size_t) noexcept {                 \
+    testing::detail::tracked_delete(memory);                                   \
+  }                                                                            \
+  void operator delete(void *memory, std::align_val_t) noexcept {              \
+    testing::detail::tracked_delete(memory);                                   \
+  }                                                                            \
+  void operator delete[](void *memory, std::align_val_t) noexcept {            \
+    testing::detail::tracked_delete(memory);                                   \
+  }                                                                            \
+  void operator delete(void *memory, std::size_t, std::align_val_t) noexcept { \
+    testing::detail::tracked_delete(memory);                                   \
+  }                                                                            \
+  void operator delete[](void *memory, std::size_t,                            \
+                         std::align_val_t) noexcept {                          \
+    testing::detail::tracked_delete(memory);                                   \
+  }                                                                            \
+  void operator delete(void *memory, const std::nothrow_t &) noexcept {        \
+    testing::detail::tracked_delete(memory);                                   \
+  }                                                                            \
+  void operator delete[](void *memory, const std::nothrow_t &) noexcept {      \
+    testing::detail::tracked_delete(memory);                                   \
+  }                                                                            \
+  void operator delete(void *memory, std::align_val_t,                         \
+                       const std::nothrow_t &) noexcept {                      \
+    testing::detail::tracked_delete(memory);                                   \
+  }                                                                            \
+  void operator delete[](void *memory, std::align_val_t,                       \
+                         const std::nothrow_t &) noexcept {                    \
+    testing::detail::tracked_delete(memory);                                   \
+  }                                                                            \
+  static_assert(true, "")
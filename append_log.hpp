@@ -0,0 +1,66 @@
+#pragma once
+
+#include <array>
+#include <atomic>
+#include <cstddef>
+#include <utility>
+
+namespace testing::detail {
+
+// Append-only list with a single writer and any number of concurrent readers.
+// Entries live in fixed-size chunks that never move, and a chunk's size is
+// only published after the entry is written, so no lock is needed on either
+// side.
+template <typename T, size_t ChunkSize = 256> class AppendLog {
+public:
+  AppendLog() = default;
+  AppendLog(const AppendLog &) = delete;
+  AppendLog(AppendLog &&) = delete;
+  AppendLog &operator=(const AppendLog &) = delete;
+  AppendLog &operator=(AppendLog &&) = delete;
+
+  ~AppendLog() {
+    Chunk *chunk = head.next.load();
+    while (chunk != nullptr) {
+      Chunk *next = chunk->next.load();
+      delete chunk;
+      chunk = next;
+    }
+  }
+
+  // Must only be called by the owning thread
+  void push_back(T value) {
+    size_t size = tail->size.load(std::memory_order_relaxed);
+    if (size == ChunkSize) {
+      auto *chunk = new Chunk{};
+      tail->next.store(chunk, std::memory_order_release);
+      tail = chunk;
+      size = 0;
+    }
+
+    tail->entries[size] = std::move(value);
+    tail->size.store(size + 1, std::memory_order_release);
+  }
+
+  template <typename Fn> void for_each(Fn &&fn) const {
+    for (const Chunk *chunk = &head; chunk != nullptr;
+         chunk = chunk->next.load(std::memory_order_acquire)) {
+      const size_t size = chunk->size.load(std::memory_order_acquire);
+      for (size_t i = 0; i < size; ++i) {
+        fn(chunk->entries[i]);
+      }
+    }
+  }
+
+private:
+  struct Chunk {
+    std::array<T, ChunkSize> entries{};
+    std::atomic<size_t> size{0};
+    std::atomic<Chunk *> next{nullptr};
+  };
+
+  Chunk head{};
+  Chunk *tail = &head;
+};
+
+} // namespace testing::detail
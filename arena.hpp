@@ -0,0 +1,101 @@
+#pragma once
+
+#include <cstddef>
+#include <cstring>
+#include <deque>
+#include <fmt/format.h>
+#include <iterator>
+#include <memory_resource>
+#include <mutex>
+#include <string_view>
+#include <vector>
+
+namespace testing::detail {
+
+// Storage for the failure messages of the whole run. Strings are copied in
+// once, never freed, and handed out as views, so results, exceptions and
+// suites can pass them around without copying or allocating.
+class MessageArena {
+public:
+  MessageArena() = default;
+  MessageArena(const MessageArena &) = delete;
+  MessageArena(MessageArena &&) = delete;
+  MessageArena &operator=(const MessageArena &) = delete;
+  MessageArena &operator=(MessageArena &&) = delete;
+  ~MessageArena() = default;
+
+  // The copy is null-terminated, so its data() can be returned as a C string
+  std::string_view store(std::string_view str) {
+    auto *data = static_cast<char *>(resource.allocate(str.size() + 1, 1));
+    std::memcpy(data, str.data(), str.size());
+    data[str.size()] = '\0';
+    return {data, str.size()};
+  }
+
+private:
+  // Most threads store a message or two, if any. The blocks grow from here.
+  static constexpr size_t initial_size = 4 * 1024;
+
+  std::pmr::monotonic_buffer_resource resource{initial_size};
+};
+
+// The arenas of the run. A thread leases one and returns it when it exits,
+// and the next thread appends to it, so there are no more arenas than
+// threads that ran at once. The views they handed out stay valid, since
+// nothing in an arena is ever freed.
+class ArenaPool {
+public:
+  MessageArena &acquire() {
+    std::lock_guard lock{mutex};
+    if (free.empty()) {
+      return arenas.emplace_back();
+    }
+    auto &arena = *free.back();
+    free.pop_back();
+    return arena;
+  }
+
+  void release(MessageArena &arena) {
+    std::lock_guard lock{mutex};
+    free.push_back(&arena);
+  }
+
+private:
+  std::mutex mutex{};
+  std::deque<MessageArena> arenas{};
+  std::vector<MessageArena *> free{};
+};
+
+inline ArenaPool &arena_pool() {
+  static ArenaPool pool;
+  return pool;
+}
+
+// Every thread stores into its own arena, so storing never locks
+inline MessageArena &message_arena() {
+  struct Lease {
+    Lease() = default;
+    Lease(const Lease &) = delete;
+    Lease(Lease &&) = delete;
+    Lease &operator=(const Lease &) = delete;
+    Lease &operator=(Lease &&) = delete;
+    ~Lease() { arena_pool().release(*arena); }
+
+    MessageArena *arena = &arena_pool().acquire();
+  };
+  thread_local Lease lease;
+  return *lease.arena;
+}
+
+// Formats straight into the arena. The intermediate buffer is reused, so once
+// it has grown a message costs one copy and no allocation.
+template <typename... Args>
+std::string_view format_message(const char *fmt_str, const Args &...args) {
+  thread_local fmt::memory_buffer buffer;
+  buffer.clear();
+  fmt::vformat_to(std::back_inserter(buffer), fmt_str,
+                  fmt::make_format_args(args...));
+  return message_arena().store({buffer.data(), buffer.size()});
+}
+
+} // namespace testing::detail
@@ -1,60 +1,212 @@
 #pragma once
 
 #include <concepts>
+#include <exception>
 #include <experimental/source_location>
 #include <fmt/core.h>
+#include <fmt/format.h>
+#include <iterator>
+#include <ranges>
 #include <sstream>
-#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <tuple>
 #include <type_traits>
+#include <vector>
 
+#include "arena.hpp"
 #include "concepts.hpp"
+#include "config.hpp"
 
 namespace testing {
 
 namespace detail {
-template <typename T> std::string to_string(T &&val) {
-  if constexpr (printable<T>) {
+
+// Writes val to out. Types with a fmt::formatter are formatted directly, types
+// that are only printable to an ostream go through a std::stringstream, and
+// other ranges are written element by element.
+template <typename T, typename OutputIt>
+OutputIt write_value(OutputIt out, const T &val) {
+  if constexpr (not std::is_enum_v<T> && fmt::is_formattable<T>::value) {
+    return fmt::format_to(out, "{}", val);
+  } else if constexpr (printable<const T &>) {
     std::stringstream s;
-    s << std::forward<T>(val);
-    return s.str();
-  } else if constexpr (std::is_enum_v<T &&>) {
-    return std::to_string(
-        static_cast<std::underlying_type_t<T>>(std::forward<T>(val)));
+    s << val;
+    return fmt::format_to(out, "{}", s.str());
+  } else if constexpr (std::is_enum_v<T>) {
+    return fmt::format_to(out, "{}",
+                          static_cast<std::underlying_type_t<T>>(val));
+  } else if constexpr (std::ranges::input_range<const T>) {
+    *out++ = '[';
+    bool first = true;
+    for (const auto &element : val) {
+      if (not first) {
+        out = fmt::format_to(out, ", ");
+      }
+      first = false;
+      out = write_value(out, element);
+    }
+    *out++ = ']';
+    return out;
   } else {
-    return "<UNPRINTABLE>";
+    return fmt::format_to(out, "<UNPRINTABLE>");
   }
 }
 
-struct AssertFailure : std::logic_error {
-  explicit AssertFailure(const std::string &what) : std::logic_error(what) {}
+// Wrappers that let assertion arguments be passed to fmt::format_to
+template <typename T> struct Printed { const T &value; };
+
+template <typename... Args> struct PrintedArgs {
+  std::tuple<const Args &...> args;
 };
 
-[[noreturn]] inline void fail(std::experimental::source_location location,
-                              std::string_view str) {
-  throw AssertFailure{fmt::format(
-      "{}:{}:{} in {}(): {}\n", location.file_name(), location.line(),
-      location.column(), location.function_name(), str)};
+template <typename T> Printed<T> printed(const T &val) { return {val}; }
+
+template <typename... Args>
+PrintedArgs<std::remove_cvref_t<Args>...> printed_args(const Args &...args) {
+  return {std::tie(args...)};
 }
 
-template <typename... Args> std::string args_string(Args &&...args) {
-  std::stringstream str;
-  ((str << to_string(std::forward<Args>(args)) << ", "), ...);
+template <typename T> std::string to_string(T &&val) {
+  return fmt::format("{}", printed(val));
+}
+
+// Buffer that assertion messages are formatted into. It's reused for every
+// failure on the same thread, so formatting only allocates while it grows.
+inline fmt::memory_buffer &message_buffer() {
+  thread_local fmt::memory_buffer buffer;
+  buffer.clear();
+  return buffer;
+}
+
+// Thrown by failed assertions. The message is a null-terminated view into the
+// message arena, so throwing and catching it copies nothing.
+struct AssertFailure : std::exception {
+  explicit AssertFailure(std::string_view _message) : message(_message) {}
+
+  [[nodiscard]] const char *what() const noexcept override {
+    return message.data();
+  }
+
+  std::string_view message;
+};
+
+// Source files of the asserts that the test running on this thread called.
+// Only collected while a dependency map is written, see DependencyMap.
+struct AssertFiles {
+  bool recording = false;
+  std::vector<const char *> files{};
+};
+
+inline AssertFiles &assert_files() {
+  thread_local AssertFiles files;
+  return files;
+}
+
+// Called by every assert, passing or not. Repeated calls from the same file
+// are only noted once.
+constexpr void
+note_assert(const std::experimental::source_location &location) {
+  if (not std::is_constant_evaluated()) {
+    auto &log = assert_files();
+    if (log.recording &&
+        (log.files.empty() || log.files.back() != location.file_name())) {
+      log.files.push_back(location.file_name());
+    }
+  }
+}
+
+// First failed assertion of the test running on this thread. Only used in
+// TESTING_NO_EXCEPTIONS mode.
+struct FailureState {
+  bool failed = false;
+  std::string_view message{};
+};
+
+inline FailureState &failure_state() {
+  thread_local FailureState state;
+  return state;
+}
+
+// While set, failures on this thread are only counted, so their messages
+// aren't stored and they get this one instead. See run_case_batch.
+inline constexpr std::string_view discarded_message = "<not stored>\n";
+
+inline bool &discarding_messages() {
+  thread_local bool discarding = false;
+  return discarding;
+}
+
+inline std::string_view
+failure_message(const std::experimental::source_location &location,
+                std::string_view str) {
+  if (discarding_messages()) {
+    return discarded_message;
+  }
+  return format_message("{}:{}:{} in {}(): {}\n", location.file_name(),
+                        location.line(), location.column(),
+                        location.function_name(), str);
+}
 
-  return str.str();
+TESTING_FAIL_NORETURN inline void
+fail(std::experimental::source_location location, std::string_view str) {
+#ifdef TESTING_NO_EXCEPTIONS
+  auto &state = failure_state();
+  if (not state.failed) {
+    state.failed = true;
+    state.message = failure_message(location, str);
+  }
+#else
+  throw AssertFailure{failure_message(location, str)};
+#endif
+}
+
+// Formats the message into the thread-local buffer before failing
+template <typename... Args>
+TESTING_FAIL_NORETURN void fail_with(std::experimental::source_location location,
+                            const char *fmt_str, const Args &...args) {
+  auto &buffer = message_buffer();
+  fmt::vformat_to(std::back_inserter(buffer), fmt_str,
+                  fmt::make_format_args(args...));
+  fail(location, {buffer.data(), buffer.size()});
+}
+
+template <typename... Args> std::string args_string(Args &&...args) {
+  return fmt::format("{}", printed_args(args...));
 }
 
 } // namespace detail
 
+// Whether an assertion of the running test failed. Always false unless
+// asserts record their failures, see TESTING_NO_EXCEPTIONS.
+[[nodiscard]] constexpr bool assertion_failed() {
+#ifdef TESTING_NO_EXCEPTIONS
+  if (not std::is_constant_evaluated()) {
+    return detail::failure_state().failed;
+  }
+#endif
+  return false;
+}
+
+// Returns from the enclosing test if the assertion failed. Without
+// TESTING_NO_EXCEPTIONS, failed assertions throw and this is a no-op wrapper.
+#define TRY_ASSERT(...)                                                        \
+  do {                                                                         \
+    __VA_ARGS__;                                                               \
+    if (testing::assertion_failed()) {                                         \
+      return;                                                                  \
+    }                                                                          \
+  } while (false)
+
 template <typename Lhs, typename Rhs>
 requires std::equality_comparable_with<Lhs, Rhs> constexpr void
 assert_eq(Lhs &&lhs, Rhs &&rhs,
           const std::experimental::source_location location =
               std::experimental::source_location::current()) {
+  detail::note_assert(location);
   if (lhs != rhs) {
-    detail::fail(location,
-                 fmt::format("ASSERT: '{}' and '{}' are not equal",
-                             detail::to_string(std::forward<Lhs>(lhs)),
-                             detail::to_string(std::forward<Rhs>(rhs))));
+    detail::fail_with(location, "ASSERT: '{}' and '{}' are not equal",
+                      detail::printed(lhs), detail::printed(rhs));
   }
 }
 
@@ -75,6 +227,7 @@ template <typename T> struct FnWithSource {
 constexpr void assert_true(bool val,
                            const std::experimental::source_location location =
                                std::experimental::source_location::current()) {
+  detail::note_assert(location);
   if (not val) {
     detail::fail(location, "ASSERT: Value is false");
   }
@@ -83,33 +236,45 @@ constexpr void assert_true(bool val,
 constexpr void assert_false(bool val,
                             const std::experimental::source_location location =
                                 std::experimental::source_location::current()) {
+  detail::note_assert(location);
   if (val) {
     detail::fail(location, "ASSERT: Value is true");
   }
 }
 
+// Checking for exceptions needs them to be enabled
+#ifdef __cpp_exceptions
 template <typename Fn, typename... Args>
 requires std::invocable<
     Fn, Args...> [[nodiscard]] constexpr std::invoke_result_t<Fn, Args...>
 assert_nothrow(const FnWithSource<Fn> &fn, Args &&...args) {
+#ifdef TESTING_NO_EXCEPTIONS
+  // After a recorded failure, something has to be returned
+  using Result = std::invoke_result_t<Fn, Args...>;
+  static_assert(std::is_void_v<Result> ||
+                std::is_default_constructible_v<Result>);
+#endif
+
+  detail::note_assert(fn.location);
   try {
     // Can't forward args here, because it's potentially used in the catch
     return std::invoke(fn.fn, args...);
 
   } catch (const std::exception &e) {
-    auto args_str = detail::args_string(std::forward<Args>(args)...);
-    detail::fail(fn.location,
-                 fmt::format("ASSERT: Unexpected std::exception thrown "
-                             "with arguments '{}'. what(): '{}'",
-                             std::move(args_str), e.what()));
+    detail::fail_with(fn.location,
+                      "ASSERT: Unexpected std::exception thrown with "
+                      "arguments '{}'. what(): '{}'",
+                      detail::printed_args(args...), e.what());
   } catch (...) {
-    auto args_str = detail::args_string(std::forward<Args>(args)...);
-    detail::fail(
+    detail::fail_with(
         fn.location,
-        fmt::format(
-            "ASSERT: Unexpected unknown exception thrown with arguments '{}'",
-            std::move(args_str)));
+        "ASSERT: Unexpected unknown exception thrown with arguments '{}'",
+        detail::printed_args(args...));
   }
+
+#ifdef TESTING_NO_EXCEPTIONS
+  return Result();
+#endif
 }
 
 // Helper that can be supplied to assert_throw to match any thrown exception
@@ -118,6 +283,7 @@ struct AnyException {};
 template <typename Exception = AnyException, typename Fn, typename... Args>
 requires std::invocable<Fn, Args...> constexpr void
 assert_throw(const FnWithSource<Fn> &fn, Args &&...args) {
+  detail::note_assert(fn.location);
   if constexpr (std::is_same_v<Exception, AnyException>) {
     try {
       // Can't forward args here, because it's used later
@@ -132,28 +298,55 @@ assert_throw(const FnWithSource<Fn> &fn, Args &&...args) {
     } catch (const Exception &) {
       return; // PASSED
     } catch (const std::exception &e) {
-      auto args_str = detail::args_string(std::forward<Args>(args)...);
-      detail::fail(fn.location,
-                   fmt::format("ASSERT:Invokation threw exception of "
-                               "unexpected type derived from std::exception "
-                               "with arguments '{}'. what(): '{}'",
-                               std::move(args_str), e.what()));
+      detail::fail_with(fn.location,
+                        "ASSERT:Invokation threw exception of unexpected "
+                        "type derived from std::exception with arguments "
+                        "'{}'. what(): '{}'",
+                        detail::printed_args(args...), e.what());
+      return;
     } catch (...) {
-      auto args_str = detail::args_string(std::forward<Args>(args)...);
-      detail::fail(
-          fn.location,
-          fmt::format("ASSERT: Invokation threw exception of unexpected and "
-                      "unknown type with arguments '{}'",
-                      std::move(args_str)));
+      detail::fail_with(fn.location,
+                        "ASSERT: Invokation threw exception of unexpected "
+                        "and unknown type with arguments '{}'",
+                        detail::printed_args(args...));
+      return;
     }
   }
 
-  auto args_str = detail::args_string(std::forward<Args>(args)...);
-  detail::fail(
+  detail::fail_with(
       fn.location,
-      fmt::format(
-          "ASSERT: Invokation did not throw an exception with arguments '{}'",
-          std::move(args_str)));
+      "ASSERT: Invokation did not throw an exception with arguments '{}'",
+      detail::printed_args(args...));
 }
+#endif
+
+} // namespace testing
 
-} // namespace testing
\ No newline at end of file
+template <typename T> struct fmt::formatter<testing::detail::Printed<T>> {
+  constexpr auto parse(format_parse_context &ctx) { return ctx.begin(); }
+
+  template <typename FormatContext>
+  auto format(const testing::detail::Printed<T> &printed,
+              FormatContext &ctx) const {
+    return testing::detail::write_value(ctx.out(), printed.value);
+  }
+};
+
+template <typename... Args>
+struct fmt::formatter<testing::detail::PrintedArgs<Args...>> {
+  constexpr auto parse(format_parse_context &ctx) { return ctx.begin(); }
+
+  template <typename FormatContext>
+  auto format(const testing::detail::PrintedArgs<Args...> &printed,
+              FormatContext &ctx) const {
+    auto out = ctx.out();
+    std::apply(
+        [&out](const auto &...args) {
+          ((out = fmt::format_to(testing::detail::write_value(out, args),
+                                 ", ")),
+           ...);
+        },
+        printed.args);
+    return out;
+  }
+};
\ No newline at end of file
@@ -0,0 +1,184 @@
+#pragma once
+
+#include <algorithm>
+#include <cmath>
+#include <cstddef>
+#include <cstdlib>
+#include <fmt/format.h>
+#include <fstream>
+#include <iterator>
+#include <map>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <utility>
+#include <vector>
+
+#include "options.hpp"
+
+namespace testing {
+
+// How a benchmark compares to its recorded baseline
+struct BenchComparison {
+  double baseline_median = 0.0;
+  double change = 0.0;  // Relative change of the median, 0.1 is 10% slower
+  double p_value = 1.0; // Probability of the slowdown being noise
+  bool regressed = false;
+};
+
+namespace detail {
+
+// Mann-Whitney U test with normal approximation and tie correction. Returns
+// the one-sided p-value for `current` being slower (larger) than `baseline`.
+inline double mann_whitney_p(const std::vector<double> &baseline,
+                             const std::vector<double> &current) {
+  const auto n_base = static_cast<double>(baseline.size());
+  const auto n_curr = static_cast<double>(current.size());
+  if (baseline.empty() || current.empty()) {
+    return 1.0;
+  }
+
+  // Pool both sample sets, with the flag telling which one it came from
+  std::vector<std::pair<double, bool>> pooled;
+  pooled.reserve(baseline.size() + current.size());
+  for (double sample : baseline) {
+    pooled.emplace_back(sample, false);
+  }
+  for (double sample : current) {
+    pooled.emplace_back(sample, true);
+  }
+  std::sort(pooled.begin(), pooled.end());
+
+  double rank_sum = 0.0;
+  double tie_term = 0.0;
+  for (size_t i = 0; i < pooled.size();) {
+    // Sorted, so a sample that isn't larger than the first one is a tie
+    size_t end = i;
+    while (end < pooled.size() && not(pooled[i].first < pooled[end].first)) {
+      ++end;
+    }
+
+    // Tied samples all get the average of their ranks
+    const auto ties = static_cast<double>(end - i);
+    const double rank = static_cast<double>(i + end + 1) / 2.0;
+    for (size_t j = i; j < end; ++j) {
+      rank_sum += pooled[j].second ? rank : 0.0;
+    }
+    tie_term += ties * ties * ties - ties;
+
+    i = end;
+  }
+
+  const double n = n_base + n_curr;
+  const double u = rank_sum - n_curr * (n_curr + 1.0) / 2.0;
+  const double mean = n_base * n_curr / 2.0;
+  const double variance =
+      n_base * n_curr / 12.0 * ((n + 1.0) - tie_term / (n * (n - 1.0)));
+  if (variance <= 0.0) {
+    return 1.0;
+  }
+
+  const double z = (u - mean) / std::sqrt(variance);
+  return 0.5 * std::erfc(z / std::sqrt(2.0));
+}
+
+inline double median_of(std::vector<double> samples) {
+  if (samples.empty()) {
+    return 0.0;
+  }
+
+  auto middle =
+      samples.begin() + static_cast<std::ptrdiff_t>(samples.size() / 2);
+  std::nth_element(samples.begin(), middle, samples.end());
+  return *middle;
+}
+
+// Benchmark samples of a previous run. The file has one line per benchmark:
+// the name, a tab, and the space-separated ns/op samples.
+class Baseline {
+public:
+  explicit Baseline(std::string _path) : path(std::move(_path)) {
+    std::ifstream file{path};
+
+    std::string line;
+    while (std::getline(file, line)) {
+      const auto tab = line.find('\t');
+      if (tab == std::string::npos) {
+        continue;
+      }
+
+      auto &samples = entries[line.substr(0, tab)];
+      const char *pos = line.c_str() + tab + 1;
+      char *end = nullptr;
+      for (double sample = std::strtod(pos, &end); end != pos;
+           sample = std::strtod(pos, &end)) {
+        samples.push_back(sample);
+        pos = end;
+      }
+    }
+  }
+
+  [[nodiscard]] const std::vector<double> *find(std::string_view name) const {
+    auto it = entries.find(name);
+    return it != entries.end() ? &it->second : nullptr;
+  }
+
+  // Replaces the samples of a benchmark and rewrites the file
+  void update(std::string_view name, const std::vector<double> &samples) {
+    entries[std::string{name}] = samples;
+
+    fmt::memory_buffer buffer;
+    for (const auto &[entry_name, entry_samples] : entries) {
+      fmt::format_to(std::back_inserter(buffer), "{}\t{:.3f}\n", entry_name,
+                     fmt::join(entry_samples, " "));
+    }
+
+    std::ofstream file{path, std::ios::trunc};
+    file.write(buffer.data(), static_cast<std::streamsize>(buffer.size()));
+  }
+
+private:
+  std::string path;
+  std::map<std::string, std::vector<double>, std::less<>> entries{};
+};
+
+inline Baseline &baseline() {
+  static Baseline instance{options().bench_baseline};
+  return instance;
+}
+
+// Compares the samples of a benchmark to the baseline, if there is one for
+// it. With options().bench_update_baseline, the baseline is replaced instead.
+inline std::optional<BenchComparison>
+compare_to_baseline(std::string_view name, const std::vector<double> &samples) {
+  if (options().bench_baseline.empty()) {
+    return std::nullopt;
+  }
+
+  if (options().bench_update_baseline) {
+    baseline().update(name, samples);
+    return std::nullopt;
+  }
+
+  const auto *recorded = baseline().find(name);
+  if (recorded == nullptr || recorded->empty()) {
+    return std::nullopt;
+  }
+
+  BenchComparison comparison;
+  comparison.baseline_median = median_of(*recorded);
+  comparison.change =
+      comparison.baseline_median > 0.0
+          ? median_of(samples) / comparison.baseline_median - 1.0
+          : 0.0;
+  comparison.p_value = mann_whitney_p(*recorded, samples);
+  comparison.regressed =
+      comparison.change > options().bench_regression_threshold &&
+      comparison.p_value < options().bench_significance;
+
+  return comparison;
+}
+
+} // namespace detail
+
+} // namespace testing
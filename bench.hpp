@@ -0,0 +1,308 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <cstddef>
+#include <fmt/format.h>
+#include <functional>
+#include <iterator>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <utility>
+#include <vector>
+
+#include "baseline.hpp"
+#include "perf.hpp"
+#include "test.hpp"
+
+namespace testing {
+
+#if defined(__GNUC__) || defined(__clang__)
+// Makes the compiler assume that value is read, so the computation producing
+// it can't be optimized away
+template <typename T> inline void do_not_optimize(const T &value) {
+  asm volatile("" : : "r,m"(value) : "memory");
+}
+
+// Makes the compiler assume that all memory is read and written here, so
+// stores before it can't be elided
+inline void clobber() { asm volatile("" : : : "memory"); }
+#else
+template <typename T> inline void do_not_optimize(const T &value) {
+  static const volatile void *sink = nullptr;
+  sink = &value;
+  std::atomic_signal_fence(std::memory_order_seq_cst);
+}
+
+inline void clobber() { std::atomic_signal_fence(std::memory_order_seq_cst); }
+#endif
+
+// Outcome of benchmarking a single function. Every sample is the average
+// time of one operation over `iterations` calls, in nanoseconds.
+struct BenchResult {
+  std::string_view name{};
+  bool passed = false;
+  std::string_view message{};
+  size_t iterations = 0;
+  std::vector<double> samples{}; // Sorted ascending
+  std::chrono::nanoseconds duration{};
+  std::optional<BenchComparison> comparison{};
+  // Hardware events of one more batch of `iterations` calls, with
+  // options().perf_counters
+  std::optional<PerfCounts> counters{};
+
+  [[nodiscard]] double min() const { return percentile(0.0); }
+  [[nodiscard]] double median() const { return percentile(0.5); }
+  [[nodiscard]] double p99() const { return percentile(0.99); }
+
+  [[nodiscard]] double percentile(double p) const {
+    if (samples.empty()) {
+      return 0.0;
+    }
+
+    auto rank = static_cast<size_t>(
+        std::ceil(p * static_cast<double>(samples.size())));
+    return samples[std::clamp<size_t>(rank, 1, samples.size()) - 1];
+  }
+};
+
+namespace detail {
+
+template <typename Fn>
+std::chrono::nanoseconds time_batch(Fn &fn, size_t iterations) {
+  const auto start = std::chrono::steady_clock::now();
+  for (size_t i = 0; i < iterations; ++i) {
+    std::invoke(fn);
+  }
+  return std::chrono::steady_clock::now() - start;
+}
+
+// Finds an iteration count for which one sample takes at least
+// options().bench_sample_time, so clock resolution doesn't skew the results
+template <typename Fn> size_t calibrate(Fn &fn) {
+  constexpr size_t max_iterations = size_t{1} << 30U;
+  const auto target = options().bench_sample_time;
+
+  size_t iterations = 1;
+  while (iterations < max_iterations) {
+    const auto elapsed = time_batch(fn, iterations);
+    if (elapsed >= target) {
+      break;
+    }
+
+    iterations *= (elapsed * 10 < target) ? 10U : 2U;
+  }
+
+  return std::min(iterations, max_iterations);
+}
+
+inline void write_bench_result(const BenchResult &result) {
+  auto &buffer = block_buffer();
+  auto out = std::back_inserter(buffer);
+
+  fmt::format_to(out, "Benchmarking {}...\n{}{}: {}", result.name,
+                 result.message, result.passed ? PASSED : FAILED,
+                 result.name);
+  if (not result.samples.empty()) {
+    fmt::format_to(out,
+                   " (min {:.2f} ns/op, median {:.2f} ns/op, p99 {:.2f} "
+                   "ns/op, {} x {} iterations",
+                   result.min(), result.median(), result.p99(),
+                   result.samples.size(), result.iterations);
+    if (result.comparison) {
+      fmt::format_to(out, ", {:+.1f}% vs baseline",
+                     100.0 * result.comparison->change);
+    }
+    if (const auto &counters = result.counters) {
+      const auto per_op = [&result](uint64_t count) {
+        return static_cast<double>(count) /
+               static_cast<double>(result.iterations);
+      };
+      fmt::format_to(out,
+                     ", {:.1f} instructions/op, {:.1f} cycles/op, {:.2f} "
+                     "cache misses/op, {:.2f} branch misses/op",
+                     per_op(counters->instructions), per_op(counters->cycles),
+                     per_op(counters->cache_misses),
+                     per_op(counters->branch_misses));
+    }
+    fmt::format_to(out, ")");
+  }
+  fmt::format_to(out, "\n\n");
+
+  output().write({buffer.data(), buffer.size()});
+}
+
+template <testsuite Suite>
+void record_bench_result(Suite &test_suite, const BenchResult &result) {
+  if (console_enabled()) {
+    write_bench_result(result);
+  }
+  if (const auto &structured = reporter()) {
+    structured->test_finished(
+        {result.name, result.passed, result.message, result.duration});
+  }
+
+  test_suite.increment_total();
+  test_suite.add_duration(result.name, result.duration, result.passed);
+
+  if (not result.passed) {
+    test_suite.increment_failed();
+    test_suite.add_failed_test(result.name);
+  }
+}
+
+} // namespace detail
+
+// Benchmarks a test function. It's run once as a normal test first, and only
+// measured if that passes. A significant slowdown against the baseline in
+// options().bench_baseline counts as a failure. Like tests, benchmarks that
+// aren't selected by the options are skipped.
+template <detail::testsuite Suite, detail::testcase Fn>
+BenchResult bench_single(Suite &test_suite, std::string_view fn_name,
+                         Fn &&fn) {
+  if (not detail::selected(fn_name)) {
+    return BenchResult{fn_name, true};
+  }
+
+  const auto start = std::chrono::steady_clock::now();
+
+  auto check = detail::run_test(fn_name, fn);
+  BenchResult result{fn_name, check.passed, check.message};
+
+  if (result.passed) {
+    // Failures while sampling are caught the same way as in a test
+    auto sampling = detail::run_test(fn_name, [&fn, &result]() {
+      result.iterations = detail::calibrate(fn);
+
+      const size_t sample_count = std::max<size_t>(options().bench_samples, 1);
+      result.samples.reserve(sample_count);
+      for (size_t i = 0; i < sample_count; ++i) {
+        const auto elapsed = detail::time_batch(fn, result.iterations);
+        result.samples.push_back(static_cast<double>(elapsed.count()) /
+                                 static_cast<double>(result.iterations));
+      }
+
+      if (detail::measuring_perf_counters()) {
+        const auto counters_start = detail::perf_events().read();
+        detail::time_batch(fn, result.iterations);
+        result.counters = detail::perf_counts_since(counters_start);
+      }
+    });
+
+    if (sampling.passed) {
+      std::sort(result.samples.begin(), result.samples.end());
+      result.comparison = detail::compare_to_baseline(fn_name, result.samples);
+    } else {
+      result.passed = false;
+      result.message = sampling.message;
+      result.samples.clear();
+    }
+  }
+
+  if (result.comparison && result.comparison->regressed) {
+    result.passed = false;
+    result.message = detail::format_message(
+        "REGRESSION: median {:.2f} ns/op vs baseline {:.2f} ns/op ({:+.1f}%, "
+        "p = {:.4f})\n",
+        result.median(), result.comparison->baseline_median,
+        100.0 * result.comparison->change, result.comparison->p_value);
+  }
+
+  result.duration = std::chrono::steady_clock::now() - start;
+  detail::record_bench_result(test_suite, result);
+
+  return result;
+}
+
+template <detail::testsuite Suite, detail::testcase... Fns>
+int bench_all(Suite &test_suite, const char *fn_names, Fns &&...fns) {
+  const auto names = detail::split_names<sizeof...(Fns)>(fn_names);
+
+  int fail_count = 0;
+  [&]<size_t... Is>(std::index_sequence<Is...>) {
+    ((fail_count += static_cast<int>(
+          not bench_single(test_suite, names[Is], fns).passed)),
+     ...);
+  }
+  (std::index_sequence_for<Fns...>{});
+
+  return fail_count;
+}
+
+namespace detail {
+
+template <testfixture Klass, testsuite Suite, typename Method>
+bool bench_single_with_fixture(Suite &test_suite, std::string_view fn_name,
+                               Method &method) {
+  Klass fixture;
+  auto fn = [&fixture, &method]() { std::invoke(method, &fixture); };
+
+  return bench_single(test_suite, fn_name, fn).passed;
+}
+
+} // namespace detail
+
+// Every method is benchmarked on its own fixture instance, which is reused
+// for all iterations. Shared fixtures are set up once for all methods.
+template <detail::testfixture Klass, detail::testsuite Suite,
+          typename... Methods>
+requires(detail::fixture_testcase<Klass, Methods> &&...) int
+bench_all_with_fixture(Suite &test_suite, const char *fn_names,
+                       Methods &&...methods) {
+  const auto names = detail::split_names<sizeof...(Methods)>(fn_names);
+  const detail::FixtureScope<Klass> fixture_scope;
+
+  int fail_count = 0;
+  [&]<size_t... Is>(std::index_sequence<Is...>) {
+    ((fail_count += static_cast<int>(
+          not detail::bench_single_with_fixture<Klass>(test_suite, names[Is],
+                                                       methods))),
+     ...);
+  }
+  (std::index_sequence_for<Methods...>{});
+
+  return fail_count;
+}
+
+#define BENCH_ALL(...)                                                         \
+  []() {                                                                       \
+    testing::TestSuite lambda_internal_suite;                                  \
+    auto lambda_internal_fail_c =                                              \
+        testing::bench_all(lambda_internal_suite, #__VA_ARGS__, __VA_ARGS__);  \
+    lambda_internal_suite.report();                                            \
+    return testing::TestInfo{std::move(lambda_internal_suite),                 \
+                             lambda_internal_fail_c};                          \
+  }()
+
+#define BENCH_ALL_FIXTURE(klass, ...)                                          \
+  []() {                                                                       \
+    testing::TestSuite lambda_internal_suite;                                  \
+    auto lambda_internal_fail_c = testing::bench_all_with_fixture<klass>(      \
+        lambda_internal_suite, #__VA_ARGS__, __VA_ARGS__);                     \
+    lambda_internal_suite.report();                                            \
+    return testing::TestInfo{std::move(lambda_internal_suite),                 \
+                             lambda_internal_fail_c};                          \
+  }()
+
+#define BENCH_ALL_SUITE(suite, ...)                                            \
+  [&suite]() {                                                                 \
+    auto lambda_internal_fail_c =                                              \
+        testing::bench_all(suite, #__VA_ARGS__, __VA_ARGS__);                  \
+    suite.report();                                                            \
+    return testing::TestInfo<decltype(suite) &>{suite,                         \
+                                                lambda_internal_fail_c};       \
+  }()
+
+#define BENCH_ALL_SUITE_FIXTURE(suite, klass, ...)                             \
+  [&suite]() {                                                                 \
+    auto lambda_internal_fail_c = testing::bench_all_with_fixture<klass>(      \
+        suite, #__VA_ARGS__, __VA_ARGS__);                                     \
+    suite.report();                                                            \
+    return testing::TestInfo<decltype(suite) &>{suite,                         \
+                                                lambda_internal_fail_c};       \
+  }()
+
+} // namespace testing
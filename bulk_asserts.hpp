@@ -0,0 +1,227 @@
+#pragma once
+
+#include <algorithm>
+#include <array>
+#include <bit>
+#include <concepts>
+#include <cstddef>
+#include <cstdint>
+#include <experimental/source_location>
+#include <fmt/format.h>
+#include <iterator>
+#include <ranges>
+#include <span>
+#include <type_traits>
+
+#include "asserts.hpp"
+
+namespace testing {
+
+// An element is near the expected one if it's within either tolerance. ULPs
+// count the representable values between them, so identical NaNs match.
+struct Tolerance {
+  double abs = 0;
+  uint64_t ulps = 0;
+};
+
+namespace detail {
+
+// Elements checked per block. The loop over a block has no early exit, so
+// the compiler can vectorize it, and only a block with a mismatch is scanned
+// again one element at a time.
+inline constexpr size_t bulk_block_size = 256;
+
+// Mismatches beyond these are only counted
+inline constexpr size_t max_described_elements = 10;
+
+struct Mismatches {
+  size_t count = 0;
+  std::array<size_t, max_described_elements> first{};
+};
+
+template <typename Matches>
+constexpr Mismatches find_mismatches(size_t size, const Matches &matches) {
+  Mismatches result;
+  for (size_t start = 0; start < size; start += bulk_block_size) {
+    const size_t end = std::min(start + bulk_block_size, size);
+
+    unsigned failed = 0;
+    for (size_t i = start; i < end; ++i) {
+      failed |= static_cast<unsigned>(not matches(i));
+    }
+    if (failed == 0) {
+      continue;
+    }
+
+    for (size_t i = start; i < end; ++i) {
+      if (not matches(i)) {
+        if (result.count < max_described_elements) {
+          result.first[result.count] = i;
+        }
+        ++result.count;
+      }
+    }
+  }
+  return result;
+}
+
+// Lists the first mismatches, each described by describe(buffer, index)
+template <typename Describe>
+TESTING_FAIL_NORETURN void
+fail_mismatches(std::experimental::source_location location,
+                std::string_view what, size_t size,
+                const Mismatches &mismatches, const Describe &describe) {
+  auto &buffer = message_buffer();
+  fmt::format_to(std::back_inserter(buffer),
+                 "ASSERT: {} of {} elements {}, the first at:",
+                 mismatches.count, size, what);
+  const size_t described = std::min(mismatches.count, max_described_elements);
+  for (size_t k = 0; k < described; ++k) {
+    fmt::format_to(std::back_inserter(buffer), "\n  [{}]: ",
+                   mismatches.first[k]);
+    describe(buffer, mismatches.first[k]);
+  }
+  fail(location, {buffer.data(), buffer.size()});
+}
+
+TESTING_FAIL_NORETURN inline void
+fail_sizes(std::experimental::source_location location, size_t lhs,
+           size_t rhs) {
+  fail_with(location, "ASSERT: Sizes {} and {} differ", lhs, rhs);
+}
+
+// Bits of a float or double as an unsigned number whose order is the order
+// of the floats, so their difference is the distance in ULPs
+template <std::floating_point T>
+requires(sizeof(T) == sizeof(uint32_t) || sizeof(T) == sizeof(uint64_t))
+constexpr auto ordered_bits(T value) {
+  using Bits = std::conditional_t<sizeof(T) == sizeof(uint32_t), uint32_t,
+                                  uint64_t>;
+  constexpr Bits sign = Bits{1} << (sizeof(Bits) * 8 - 1);
+  const auto bits = std::bit_cast<Bits>(value);
+  return static_cast<Bits>((bits & sign) != 0 ? ~bits : bits | sign);
+}
+
+template <typename T>
+constexpr T absolute_difference(T lhs, T rhs) {
+  return lhs < rhs ? rhs - lhs : lhs - rhs;
+}
+
+} // namespace detail
+
+// Element-wise assert_eq of two contiguous ranges of the same size, e.g.
+// std::vectors, arrays or spans. Comparisons run in vectorizable blocks, and
+// a failure lists the first mismatching indices and values.
+template <std::ranges::contiguous_range Actual,
+          std::ranges::contiguous_range Expected>
+requires std::ranges::sized_range<Actual> &&
+    std::ranges::sized_range<Expected> &&
+    std::equality_comparable_with<std::ranges::range_value_t<Actual>,
+                                  std::ranges::range_value_t<Expected>>
+constexpr void
+assert_all_eq(const Actual &actual, const Expected &expected,
+              const std::experimental::source_location location =
+                  std::experimental::source_location::current()) {
+  detail::note_assert(location);
+  const std::span lhs{std::ranges::data(actual), std::ranges::size(actual)};
+  const std::span rhs{std::ranges::data(expected),
+                      std::ranges::size(expected)};
+  if (lhs.size() != rhs.size()) {
+    detail::fail_sizes(location, lhs.size(), rhs.size());
+    return;
+  }
+
+  const auto mismatches = detail::find_mismatches(
+      lhs.size(), [lhs, rhs](size_t i) { return lhs[i] == rhs[i]; });
+  if (mismatches.count > 0) {
+    detail::fail_mismatches(location, "are not equal", lhs.size(),
+                            mismatches, [lhs, rhs](auto &buffer, size_t i) {
+                              fmt::format_to(std::back_inserter(buffer),
+                                             "'{}' and '{}'",
+                                             detail::printed(lhs[i]),
+                                             detail::printed(rhs[i]));
+                            });
+  }
+}
+
+// Same for floats or doubles that may differ by the tolerance
+template <std::ranges::contiguous_range Actual,
+          std::ranges::contiguous_range Expected>
+requires std::ranges::sized_range<Actual> &&
+    std::ranges::sized_range<Expected> &&
+    std::same_as<std::ranges::range_value_t<Actual>,
+                 std::ranges::range_value_t<Expected>> &&
+    requires(std::ranges::range_value_t<Actual> value) {
+  detail::ordered_bits(value);
+}
+constexpr void
+assert_all_near(const Actual &actual, const Expected &expected,
+                Tolerance tolerance,
+                const std::experimental::source_location location =
+                    std::experimental::source_location::current()) {
+  using T = std::ranges::range_value_t<Actual>;
+
+  detail::note_assert(location);
+  const std::span lhs{std::ranges::data(actual), std::ranges::size(actual)};
+  const std::span rhs{std::ranges::data(expected),
+                      std::ranges::size(expected)};
+  if (lhs.size() != rhs.size()) {
+    detail::fail_sizes(location, lhs.size(), rhs.size());
+    return;
+  }
+
+  const auto abs = static_cast<T>(tolerance.abs);
+  const auto ulps = tolerance.ulps;
+  const auto near = [lhs, rhs, abs, ulps](size_t i) {
+    const auto ulp_distance = detail::absolute_difference(
+        detail::ordered_bits(lhs[i]), detail::ordered_bits(rhs[i]));
+    return detail::absolute_difference(lhs[i], rhs[i]) <= abs ||
+           ulp_distance <= ulps;
+  };
+
+  const auto mismatches = detail::find_mismatches(lhs.size(), near);
+  if (mismatches.count > 0) {
+    detail::fail_mismatches(
+        location, "are not near", lhs.size(), mismatches,
+        [lhs, rhs](auto &buffer, size_t i) {
+          fmt::format_to(std::back_inserter(buffer),
+                         "'{}' and '{}' differ by {} ({} ULPs)",
+                         detail::printed(lhs[i]), detail::printed(rhs[i]),
+                         detail::absolute_difference(lhs[i], rhs[i]),
+                         detail::absolute_difference(
+                             detail::ordered_bits(lhs[i]),
+                             detail::ordered_bits(rhs[i])));
+        });
+  }
+}
+
+// Checks that min <= value <= max for every value of a contiguous range
+template <std::ranges::contiguous_range Values>
+requires std::ranges::sized_range<Values> &&
+    std::totally_ordered<std::ranges::range_value_t<Values>>
+constexpr void
+assert_all_in_range(const Values &values,
+                    const std::ranges::range_value_t<Values> &min,
+                    const std::ranges::range_value_t<Values> &max,
+                    const std::experimental::source_location location =
+                        std::experimental::source_location::current()) {
+  detail::note_assert(location);
+  const std::span span{std::ranges::data(values), std::ranges::size(values)};
+
+  const auto mismatches =
+      detail::find_mismatches(span.size(), [span, &min, &max](size_t i) {
+        return not(span[i] < min) && not(max < span[i]);
+      });
+  if (mismatches.count > 0) {
+    detail::fail_mismatches(
+        location, "are out of range", span.size(), mismatches,
+        [span, &min, &max](auto &buffer, size_t i) {
+          fmt::format_to(std::back_inserter(buffer),
+                         "'{}' is not in ['{}', '{}']",
+                         detail::printed(span[i]), detail::printed(min),
+                         detail::printed(max));
+        });
+  }
+}
+
+} // namespace testing
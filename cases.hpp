@@ -0,0 +1,268 @@
+#pragma once
+
+#include <algorithm>
+#include <chrono>
+#include <cstddef>
+#include <deque>
+#include <fmt/format.h>
+#include <functional>
+#include <future>
+#include <iterator>
+#include <optional>
+#include <ranges>
+#include <string_view>
+#include <utility>
+#include <vector>
+
+#include "mapped_file.hpp"
+#include "test.hpp"
+
+namespace testing {
+
+namespace detail {
+
+// Failed cases beyond these are only counted, and their asserts don't store
+// a message, so a broken test over millions of rows doesn't produce millions
+// of messages. A batch stores at most this many, and the first ones in the
+// order of the range are described.
+inline constexpr size_t max_described_cases = 10;
+
+// Cases of one batch that are buffered from a range without random access
+inline constexpr size_t buffered_batch_size = 4096;
+
+struct CaseFailure {
+  size_t index = 0;
+  std::string_view message{};
+};
+
+// Outcome of a batch of cases, or of all of them once merged
+struct CaseResults {
+  size_t total = 0;
+  size_t failed = 0;
+  std::vector<CaseFailure> failures{};
+
+  void merge(CaseResults &&other) {
+    total += other.total;
+    failed += other.failed;
+    for (auto &failure : other.failures) {
+      if (failures.size() < max_described_cases) {
+        failures.push_back(failure);
+      }
+    }
+  }
+};
+
+// Message of a failed case, or none if it passed. Unlike run_test, nothing is
+// printed, timed or recorded, so a case costs little more than the call.
+template <typename Fn, typename T>
+std::optional<std::string_view> run_case(Fn &fn, T &&value) {
+#ifdef __cpp_exceptions
+  try {
+    std::invoke(fn, std::forward<T>(value));
+  } catch (const AssertFailure &e) {
+    return e.message;
+  } catch (const std::exception &e) {
+    if (discarding_messages()) {
+      return discarded_message;
+    }
+    return format_message(
+        "ERROR: Unexpected std::exception escaped the test. what(): '{}'\n",
+        e.what());
+  } catch (...) {
+    return "ERROR: Unexpected unknown exception escaped the test\n";
+  }
+#else
+  std::invoke(fn, std::forward<T>(value));
+#endif
+
+#ifdef TESTING_NO_EXCEPTIONS
+  if (failure_state().failed) {
+    failure_state().failed = false;
+    return failure_state().message;
+  }
+#endif
+
+  return std::nullopt;
+}
+
+// Runs count cases starting at first, the first of which has the given index
+template <typename Fn, typename It>
+CaseResults run_case_batch(Fn &fn, It first, size_t count, size_t index) {
+  CaseResults results{count};
+  auto &discarding = discarding_messages();
+  for (size_t i = 0; i < count; ++i, ++first) {
+    discarding = results.failures.size() >= max_described_cases;
+    const auto message = run_case(fn, *first);
+    if (not message) {
+      continue;
+    }
+
+    if (results.failures.size() < max_described_cases) {
+      results.failures.push_back(
+          {index + i,
+           format_message("Case {} with arguments '{}':\n{}", index + i,
+                          args_string(*first), *message)});
+    }
+    ++results.failed;
+  }
+  discarding = false;
+  return results;
+}
+
+// Enough batches that every worker gets a few, to balance uneven cases
+inline size_t case_batch_size(size_t cases, size_t workers) {
+  return std::max<size_t>(cases / (workers * 8), 1);
+}
+
+// Batches that were submitted to the pool, merged in order. Only a few are
+// pending at once, so a generator is never buffered completely.
+class PendingBatches {
+public:
+  explicit PendingBatches(size_t _limit) : limit(_limit) {}
+
+  template <typename Batch> void submit(ThreadPool &pool, Batch batch) {
+    pending.push_back(pool.submit(std::move(batch)));
+    if (pending.size() > limit) {
+      collect_one();
+    }
+  }
+
+  CaseResults finish() {
+    while (not pending.empty()) {
+      collect_one();
+    }
+    return std::move(results);
+  }
+
+private:
+  void collect_one() {
+    results.merge(pending.front().get());
+    pending.pop_front();
+  }
+
+  size_t limit;
+  std::deque<std::future<CaseResults>> pending{};
+  CaseResults results{};
+};
+
+// Runs fn with every element of the range. Ranges with random access are
+// split into batches in place, others are buffered one batch at a time.
+template <typename Fn, std::ranges::input_range Range>
+CaseResults run_cases(Fn &fn, Range &&range) {
+  const size_t workers = default_parallelism();
+
+  if constexpr (std::ranges::random_access_range<Range> &&
+                std::ranges::sized_range<Range>) {
+    const auto total = static_cast<size_t>(std::ranges::size(range));
+    const size_t batch_size = case_batch_size(total, workers);
+    auto first = std::ranges::begin(range);
+    if (batch_size >= total) {
+      return run_case_batch(fn, first, total, 0);
+    }
+
+    ThreadPool pool{std::min(workers, (total + batch_size - 1) / batch_size)};
+    PendingBatches batches{2 * workers};
+    for (size_t start = 0; start < total; start += batch_size) {
+      const size_t count = std::min(batch_size, total - start);
+      auto batch_first = first + static_cast<std::ptrdiff_t>(start);
+      batches.submit(pool, [&fn, batch_first, count, start]() {
+        return run_case_batch(fn, batch_first, count, start);
+      });
+    }
+    return batches.finish();
+  } else {
+    using Value = std::ranges::range_value_t<Range>;
+
+    ThreadPool pool{workers};
+    PendingBatches batches{2 * workers};
+    std::vector<Value> buffer;
+    size_t start = 0;
+    auto submit = [&]() {
+      const size_t count = buffer.size();
+      batches.submit(pool, [&fn, cases = std::move(buffer), start]() {
+        return run_case_batch(fn, cases.begin(), cases.size(), start);
+      });
+      start += count;
+      buffer.clear();
+    };
+
+    for (auto &&value : range) {
+      buffer.push_back(std::forward<decltype(value)>(value));
+      if (buffer.size() == buffered_batch_size) {
+        submit();
+      }
+    }
+    if (not buffer.empty()) {
+      submit();
+    }
+    return batches.finish();
+  }
+}
+
+// One message for all failed cases, in the order of the range
+inline std::string_view cases_message(const CaseResults &results) {
+  if (results.total == 0) {
+    return "ERROR: There are no cases to run\n";
+  }
+
+  fmt::memory_buffer buffer;
+  fmt::format_to(std::back_inserter(buffer), "{} of {} cases failed\n",
+                 results.failed, results.total);
+  for (const auto &failure : results.failures) {
+    append(buffer, failure.message);
+  }
+  if (results.failed > results.failures.size()) {
+    fmt::format_to(std::back_inserter(buffer), "... and {} more\n",
+                   results.failed - results.failures.size());
+  }
+  return message_arena().store({buffer.data(), buffer.size()});
+}
+
+} // namespace detail
+
+// Runs a test once for every element of a range, e.g. a container, a
+// generator or the lines of a MappedFile, and reports it as a single test
+// that fails if any case does. The cases run in batches on a thread pool,
+// so the test must be safe to call concurrently. An empty range fails, since
+// it's usually a data file that couldn't be read.
+template <detail::testsuite Suite, typename Fn, std::ranges::input_range Range>
+requires std::invocable<Fn &, std::ranges::range_reference_t<Range>>
+bool test_cases(Suite &test_suite, std::string_view fn_name, Fn &&fn,
+                Range &&range) {
+  if (not detail::selected(fn_name)) {
+    return true;
+  }
+
+  const auto start = std::chrono::steady_clock::now();
+  const auto cases = detail::run_cases(fn, std::forward<Range>(range));
+
+  TestResult result{fn_name, cases.total > 0 && cases.failed == 0};
+  if (not result.passed) {
+    result.message = detail::cases_message(cases);
+  }
+  result.duration = std::chrono::steady_clock::now() - start;
+  detail::record_result(test_suite, result);
+
+  return result.passed;
+}
+
+} // namespace testing
+
+#define TEST_CASES(fn, ...)                                                    \
+  [&]() {                                                                      \
+    testing::TestSuite lambda_internal_suite;                                  \
+    auto lambda_internal_fail_c = static_cast<int>(                            \
+        not testing::test_cases(lambda_internal_suite, #fn, fn, __VA_ARGS__)); \
+    lambda_internal_suite.report();                                            \
+    return testing::TestInfo{std::move(lambda_internal_suite),                 \
+                             lambda_internal_fail_c};                          \
+  }()
+
+#define TEST_CASES_SUITE(suite, fn, ...)                                       \
+  [&]() {                                                                      \
+    auto lambda_internal_fail_c = static_cast<int>(                            \
+        not testing::test_cases(suite, #fn, fn, __VA_ARGS__));                 \
+    suite.report();                                                            \
+    return testing::TestInfo<decltype(suite) &>{suite,                         \
+                                                lambda_internal_fail_c};       \
+  }()
@@ -0,0 +1,48 @@
+# Adds a <target>_constexpr_budget target, which compiles <source> once per
+# constexpr test and prints what every test costs the front end. See
+# constexpr_budget.py for how the cost is measured.
+#
+#   testing_constexpr_budget(<target> <source>
+#                            [STEPS] [REPEAT <n>] [BUDGET_MS <ms>]
+#                            [TIME_TRACE_DIR <dir>])
+#
+# STEPS also searches the constexpr operation count of every test, which
+# takes a few dozen compilations per test. With BUDGET_MS, the target fails
+# if a test costs more. The compile command comes from
+# compile_commands.json, so CMAKE_EXPORT_COMPILE_COMMANDS has to be on.
+
+find_package(Python3 COMPONENTS Interpreter)
+
+set(TESTING_CONSTEXPR_BUDGET_SCRIPT ${CMAKE_CURRENT_LIST_DIR}/constexpr_budget.py)
+
+function(testing_constexpr_budget target source)
+  cmake_parse_arguments(PARSE_ARGV 2 ARG "STEPS" "REPEAT;BUDGET_MS;TIME_TRACE_DIR" "")
+
+  if(NOT Python3_Interpreter_FOUND)
+    message(STATUS "Python 3 not found, not adding ${target}_constexpr_budget")
+    return()
+  endif()
+
+  get_filename_component(source_path ${source} ABSOLUTE)
+  set(args --compile-commands ${CMAKE_BINARY_DIR}/compile_commands.json
+           --source ${source_path})
+  if(ARG_STEPS)
+    list(APPEND args --steps)
+  endif()
+  if(ARG_REPEAT)
+    list(APPEND args --repeat ${ARG_REPEAT})
+  endif()
+  if(ARG_BUDGET_MS)
+    list(APPEND args --budget-ms ${ARG_BUDGET_MS})
+  endif()
+  if(ARG_TIME_TRACE_DIR)
+    list(APPEND args --time-trace ${ARG_TIME_TRACE_DIR})
+  endif()
+
+  add_custom_target(${target}_constexpr_budget
+                    COMMAND Python3::Interpreter ${TESTING_CONSTEXPR_BUDGET_SCRIPT} ${args}
+                    WORKING_DIRECTORY ${CMAKE_BINARY_DIR}
+                    COMMENT "Measuring the constexpr tests of ${source}"
+                    USES_TERMINAL
+                    VERBATIM)
+endfunction()
@@ -0,0 +1,227 @@
+#!/usr/bin/env python3
+"""Measures what every constexpr test of a source file costs the compiler.
+
+The file is compiled once per test with -DTESTING_CONSTEXPR_ONLY=<name>, so
+only that test is constant evaluated, and once with no test at all as the
+baseline. A test's cost is its front-end time minus the baseline. With
+--steps, the smallest constexpr operation limit that still compiles is
+searched for as well.
+
+Tests are found in the TEST_ALL_CONSTEXPR, TEST_ALL_AUTO and fixture variants
+of the source. The compile command is taken from compile_commands.json. A
+measured TEST_ALL_AUTO test has to be constant evaluated, so one that only
+runs at runtime shows up as failed.
+"""
+
+import argparse
+import json
+import os
+import re
+import shlex
+import subprocess
+import sys
+import time
+
+MACRO = re.compile(r"\bTEST_ALL(_FIXTURE)?_(CONSTEXPR|AUTO)\s*\(")
+
+# Compile flags that only make sense when writing an output
+DROPPED_WITH_VALUE = {"-o", "-MF", "-MT", "-MQ"}
+DROPPED = {"-c", "-MD", "-MMD"}
+
+FIRST_STEPS = 1 << 10
+MAX_STEPS = 1 << 31
+
+
+def macro_arguments(source, start):
+    """Top-level arguments of the call whose '(' is right before start"""
+    args = []
+    depth = 0
+    current = ""
+    for c in source[start:]:
+        if c in "([{":
+            depth += 1
+        elif c in ")]}":
+            if depth == 0:
+                args.append(current.strip())
+                return args
+            depth -= 1
+        elif c == "," and depth == 0:
+            args.append(current.strip())
+            current = ""
+            continue
+        current += c
+    return args
+
+
+def find_tests(source):
+    """Names of the constexpr tests, the way the framework reports them"""
+    names = []
+    for match in MACRO.finditer(source):
+        args = macro_arguments(source, match.end())
+        if match.group(1):
+            args = args[1:]
+        for arg in args:
+            name = arg.lstrip("& \t\n")
+            if name and name not in names:
+                names.append(name)
+    return names
+
+
+def same_file(lhs, rhs):
+    lhs, rhs = os.path.normpath(lhs), os.path.normpath(rhs)
+    if len(lhs) < len(rhs):
+        lhs, rhs = rhs, lhs
+    return lhs == rhs or lhs.endswith(os.sep + rhs)
+
+
+def find_command(compile_commands, source):
+    with open(compile_commands, encoding="utf-8") as file:
+        entries = json.load(file)
+
+    for entry in entries:
+        path = os.path.join(entry.get("directory", ""), entry["file"])
+        if not same_file(path, source):
+            continue
+
+        if "arguments" in entry:
+            args = list(entry["arguments"])
+        else:
+            args = shlex.split(entry["command"])
+        return entry.get("directory", "."), args
+
+    sys.exit(f"{source} isn't in {compile_commands}")
+
+
+def syntax_only(args):
+    """The compile command, but stopping after the front end"""
+    result = []
+    skip = False
+    for arg in args:
+        if skip:
+            skip = False
+        elif arg in DROPPED_WITH_VALUE:
+            skip = True
+        elif arg not in DROPPED and not arg.startswith("-o"):
+            result.append(arg)
+    return result + ["-fsyntax-only"]
+
+
+def steps_flag(compiler):
+    if "clang" in os.path.basename(compiler):
+        return "-fconstexpr-steps="
+    return "-fconstexpr-ops-limit="
+
+
+class Compiler:
+    def __init__(self, directory, args, repeat):
+        self.directory = directory
+        self.args = syntax_only(args)
+        self.repeat = repeat
+
+    def compiles(self, only, extra=()):
+        # Appended, so they override the limits of the original command
+        command = self.args + [f"-DTESTING_CONSTEXPR_ONLY={only}", *extra]
+        return subprocess.run(command, cwd=self.directory,
+                              stdout=subprocess.DEVNULL,
+                              stderr=subprocess.DEVNULL,
+                              check=False).returncode == 0
+
+    def seconds(self, only, extra=()):
+        """Fastest of the repeated compilations, to filter out noise"""
+        best = None
+        for _ in range(self.repeat):
+            start = time.perf_counter()
+            if not self.compiles(only, extra):
+                return None
+            elapsed = time.perf_counter() - start
+            best = elapsed if best is None else min(best, elapsed)
+        return best
+
+    def steps(self, only):
+        """Smallest constexpr operation limit the compilation passes with.
+        Every probe is a compilation, so it's only searched to 1%."""
+        flag = steps_flag(self.args[0])
+        low, high = 0, FIRST_STEPS
+        while not self.compiles(only, [f"{flag}{high}"]):
+            if high >= MAX_STEPS:
+                return None
+            low, high = high, high * 2
+        while high - low > high // 100:
+            mid = (low + high) // 2
+            if self.compiles(only, [f"{flag}{mid}"]):
+                high = mid
+            else:
+                low = mid
+        return high
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__.splitlines()[0])
+    parser.add_argument("--compile-commands", required=True)
+    parser.add_argument("--source", required=True)
+    parser.add_argument("--repeat", type=int, default=3,
+                        help="compilations per test, the fastest counts")
+    parser.add_argument("--steps", action="store_true",
+                        help="also search the constexpr operation count")
+    parser.add_argument("--time-trace", metavar="DIR",
+                        help="write a Clang -ftime-trace file per test")
+    parser.add_argument("--budget-ms", type=float,
+                        help="fail if a test costs more than this")
+    opts = parser.parse_args()
+
+    with open(opts.source, encoding="utf-8") as file:
+        tests = find_tests(file.read())
+    if not tests:
+        sys.exit(f"No constexpr tests in {opts.source}")
+
+    directory, args = find_command(opts.compile_commands, opts.source)
+    compiler = Compiler(directory, args, max(opts.repeat, 1))
+
+    baseline = compiler.seconds("")
+    if baseline is None:
+        sys.exit(f"{opts.source} doesn't compile without its constexpr tests")
+    baseline_steps = compiler.steps("") if opts.steps else None
+
+    results = []
+    for name in tests:
+        extra = []
+        if opts.time_trace:
+            os.makedirs(opts.time_trace, exist_ok=True)
+            trace = os.path.join(os.path.abspath(opts.time_trace),
+                                 re.sub(r"\W", "_", name) + ".json")
+            extra.append(f"-ftime-trace={trace}")
+
+        seconds = compiler.seconds(name, extra)
+        steps = compiler.steps(name) if opts.steps else None
+        results.append((name, seconds, steps))
+
+    results.sort(key=lambda r: -1 if r[1] is None else r[1], reverse=True)
+
+    print(f"Baseline: {baseline * 1000:.1f} ms", end="")
+    print(f", {baseline_steps} steps" if baseline_steps else "")
+    print(f"{'ms':>10} {'steps':>12}  test")
+
+    over_budget = False
+    for name, seconds, steps in results:
+        if seconds is None:
+            print(f"{'FAILED':>10} {'':>12}  {name}")
+            over_budget = True
+            continue
+
+        cost = max(seconds - baseline, 0.0) * 1000
+        # Only a limit above the baseline's is the test's own
+        step_text = ""
+        if steps is not None and baseline_steps is not None:
+            step_text = str(steps) if steps > baseline_steps else "<=baseline"
+        print(f"{cost:>10.1f} {step_text:>12}  {name}")
+
+        if opts.budget_ms is not None and cost > opts.budget_ms:
+            over_budget = True
+
+    if over_budget:
+        print("Some constexpr tests failed or are over budget")
+    return 1 if over_budget else 0
+
+
+if __name__ == "__main__":
+    sys.exit(main())
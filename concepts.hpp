@@ -1,8 +1,12 @@
 #pragma once
 
+#include <chrono>
+#include <cstddef>
 #include <concepts>
 #include <functional>
 #include <iostream>
+#include <string_view>
+#include <vector>
 
 namespace testing::detail {
 template <typename T> concept printable = requires(T &&t) {
@@ -21,6 +25,23 @@ template <typename T> concept testfixture = requires(T &&t) {
   requires std::is_default_constructible_v<T>;
 };
 
+// A fixture with static setup() and teardown() for state shared by its tests.
+// setup() runs before the first test of a list and teardown() after the last.
+template <typename T> concept shared_fixture = requires() {
+  requires testfixture<T>;
+
+  T::setup();
+  T::teardown();
+};
+
+// A fixture with reset() is constructed once per thread and reset between
+// tests, instead of being constructed for every test
+template <typename T> concept resettable_fixture = requires(T &fixture) {
+  requires testfixture<T>;
+
+  fixture.reset();
+};
+
 template <typename Class, typename Method>
 concept fixture_testcase = requires(Class fixture, Method &&method) {
   requires testfixture<Class>;
@@ -30,11 +51,13 @@ concept fixture_testcase = requires(Class fixture, Method &&method) {
 };
 
 template <typename T>
-concept testsuite = requires(T suite, std::string_view sv) {
+concept testsuite = requires(T suite, std::string_view sv,
+                             std::chrono::nanoseconds duration, bool passed) {
   { suite.status() }
   ->std::same_as<int>;
 
   suite.add_failed_test(sv);
+  suite.add_duration(sv, duration, passed);
 
   suite.increment_total();
   suite.increment_failed();
@@ -42,6 +65,25 @@ concept testsuite = requires(T suite, std::string_view sv) {
   suite.report();
 };
 
+// A list of tests that can be run by index, like a TestTable
+template <typename T>
+concept test_list = requires(const T &tests, size_t i) {
+  { tests.size() }
+  ->std::convertible_to<size_t>;
+  { tests.name(i) }
+  ->std::convertible_to<std::string_view>;
+
+  tests.invoke(i);
+};
+
+// A test list with a sorted name index, like the Registry
+template <typename T>
+concept indexed_test_list = test_list<T> &&
+    requires(const T &tests, std::string_view prefix) {
+  { tests.with_prefix(prefix) }
+  ->std::convertible_to<std::vector<size_t>>;
+};
+
 template <auto> struct constant_evaluation_helper;
 
 template <void (*fn)()> concept constexpr_testcase = requires() {
@@ -51,4 +93,10 @@ template <void (*fn)()> concept constexpr_testcase = requires() {
   typename constant_evaluation_helper<(fn(), 0)>;
 };
 
+// Same for the test at index I of a table. A failed assertion makes the call
+// a non-constant expression, so this is false for failed tests, too.
+template <const auto &tests, size_t I> concept constant_test = requires() {
+  typename constant_evaluation_helper<(tests.invoke(I), 0)>;
+};
+
 } // namespace testing::detail
\ No newline at end of file
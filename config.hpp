@@ -0,0 +1,48 @@
+#pragma once
+
+// Without exceptions, failed assertions can't unwind the test. In
+// TESTING_NO_EXCEPTIONS mode they record the failure in thread-local state
+// and return instead, and the runners check that state after every test. Use
+// TRY_ASSERT to leave a test at its first failed assertion.
+// The mode is selected automatically when compiling with -fno-exceptions, but
+// can also be requested explicitly, e.g. for tests that fail very often.
+#if !defined(TESTING_NO_EXCEPTIONS) && !defined(__cpp_exceptions)
+#define TESTING_NO_EXCEPTIONS
+#endif
+
+#ifdef TESTING_NO_EXCEPTIONS
+#define TESTING_FAIL_NORETURN
+#else
+#define TESTING_FAIL_NORETURN [[noreturn]]
+#endif
+
+// Process isolation needs fork() and Unix sockets. Without them, isolated
+// tests run in the calling process.
+#if !defined(TESTING_HAS_FORK) && __has_include(<unistd.h>) &&                 \
+    __has_include(<sys/socket.h>) && __has_include(<sys/wait.h>) &&            \
+    __has_include(<poll.h>)
+#define TESTING_HAS_FORK
+#endif
+
+// Data files are mapped into memory with mmap() if it's available, and read
+// into memory otherwise
+#if !defined(TESTING_HAS_MMAP) && __has_include(<sys/mman.h>) &&               \
+    __has_include(<sys/stat.h>) && __has_include(<fcntl.h>) &&                 \
+    __has_include(<unistd.h>)
+#define TESTING_HAS_MMAP
+#endif
+
+// Hardware counters are read through perf_event_open() on Linux. Elsewhere,
+// they're reported as unavailable.
+#if !defined(TESTING_HAS_PERF_EVENTS) &&                                       \
+    __has_include(<linux/perf_event.h>) && __has_include(<sys/syscall.h>) &&   \
+    __has_include(<unistd.h>)
+#define TESTING_HAS_PERF_EVENTS
+#endif
+
+// Threads of STRESS can only be pinned to CPUs with Linux's
+// pthread_setaffinity_np(). Elsewhere, they're scheduled freely.
+#if !defined(TESTING_HAS_THREAD_AFFINITY) && defined(__linux__) &&             \
+    __has_include(<pthread.h>) && __has_include(<sched.h>)
+#define TESTING_HAS_THREAD_AFFINITY
+#endif
@@ -0,0 +1,403 @@
+#pragma once
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdio>
+#include <deque>
+#include <fstream>
+#include <functional>
+#include <iostream>
+#include <iterator>
+#include <map>
+#include <mutex>
+#include <optional>
+#include <set>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+#include "asserts.hpp"
+#include "options.hpp"
+#include "registry.hpp"
+
+namespace testing::detail {
+
+// Whether two paths name the same file, assuming one may be relative to a
+// directory the other one spells out. /src/a/b.cpp matches a/b.cpp and
+// b.cpp, but not ab.cpp.
+constexpr bool same_file(std::string_view lhs, std::string_view rhs) {
+  if (lhs.size() < rhs.size()) {
+    std::swap(lhs, rhs);
+  }
+  if (rhs.empty() || not lhs.ends_with(rhs)) {
+    return false;
+  }
+  return lhs.size() == rhs.size() || rhs.front() == '/' ||
+         lhs[lhs.size() - rhs.size() - 1] == '/';
+}
+
+constexpr std::string_view base_name(std::string_view path) {
+  return path.substr(path.find_last_of('/') + 1);
+}
+
+// Source files that every test calls asserts in, plus the file registered
+// tests are defined in. Written to options().write_deps_file at exit, one
+// `name\tfile` line per dependency.
+class DependencyMap {
+public:
+  DependencyMap() = default;
+  DependencyMap(const DependencyMap &) = delete;
+  DependencyMap(DependencyMap &&) = delete;
+  DependencyMap &operator=(const DependencyMap &) = delete;
+  DependencyMap &operator=(DependencyMap &&) = delete;
+
+  ~DependencyMap() {
+    const auto &path = options().write_deps_file;
+    if (path.empty() || tests.empty()) {
+      return;
+    }
+
+    for (const auto &entry : registry().entries()) {
+      if (auto it = tests.find(entry.name); it != tests.end()) {
+        it->second.emplace(entry.file);
+      }
+    }
+
+    std::FILE *file = std::fopen(path.c_str(), "w");
+    if (file == nullptr) {
+      std::fprintf(stderr, "Could not open dependency file '%s'\n",
+                   path.c_str());
+      return;
+    }
+    for (const auto &[name, files] : tests) {
+      for (const auto &source : files) {
+        std::fprintf(file, "%s\t%s\n", name.c_str(), source.c_str());
+      }
+    }
+    std::fclose(file);
+  }
+
+  void add(std::string_view name, const std::vector<const char *> &files) {
+    std::lock_guard lock{mutex};
+    auto &sources = tests[std::string{name}];
+    for (const char *source : files) {
+      sources.emplace(source);
+    }
+  }
+
+private:
+  std::mutex mutex{};
+  std::map<std::string, std::set<std::string>, std::less<>> tests{};
+};
+
+inline DependencyMap &dependency_map() {
+  static DependencyMap instance;
+  return instance;
+}
+
+// Brackets a test, so the files of its asserts are added to the map
+inline void start_recording() {
+  auto &log = assert_files();
+  log.recording = not options().write_deps_file.empty();
+  log.files.clear();
+}
+
+inline void stop_recording(std::string_view name) {
+  auto &log = assert_files();
+  if (log.recording) {
+    dependency_map().add(name, log.files);
+    log.recording = false;
+  }
+}
+
+// Reads the string starting at the opening quote at pos, and moves pos past
+// the closing one. Only the escapes that appear in paths are handled.
+inline std::string read_json_string(std::string_view json, size_t &pos) {
+  std::string result;
+  for (++pos; pos < json.size() && json[pos] != '"'; ++pos) {
+    if (json[pos] == '\\' && pos + 1 < json.size()) {
+      ++pos;
+    }
+    result.push_back(json[pos]);
+  }
+  ++pos;
+  return result;
+}
+
+// Entry of compile_commands.json
+struct CompileCommand {
+  std::string directory{};
+  std::string file{};
+  std::string output{};
+};
+
+// Object file of a compiler command line, for entries without an `output`
+inline std::string output_of(std::string_view command) {
+  const auto flag = command.find(" -o ");
+  if (flag == std::string_view::npos) {
+    return {};
+  }
+
+  const auto begin = flag + 4;
+  return std::string{command.substr(begin, command.find(' ', begin) - begin)};
+}
+
+// Reads the `directory`, `file` and `output` of every entry. The format is
+// written by CMake and other tools, so this only scans for those keys instead
+// of validating it.
+inline std::vector<CompileCommand>
+read_compile_commands(const std::string &path) {
+  std::ifstream in{path};
+  const std::string json{std::istreambuf_iterator<char>{in}, {}};
+
+  std::vector<CompileCommand> commands;
+  int depth = 0;
+  for (size_t pos = 0; pos < json.size();) {
+    const char c = json[pos];
+    if (c == '{') {
+      if (++depth == 1) {
+        commands.emplace_back();
+      }
+      ++pos;
+    } else if (c == '}') {
+      --depth;
+      ++pos;
+    } else if (c != '"') {
+      ++pos;
+    } else {
+      const auto key = read_json_string(json, pos);
+      while (pos < json.size() && (json[pos] == ' ' || json[pos] == ':')) {
+        ++pos;
+      }
+      if (depth != 1 || commands.empty() || pos >= json.size() ||
+          json[pos] != '"') {
+        continue;
+      }
+
+      auto value = read_json_string(json, pos);
+      if (key == "directory") {
+        commands.back().directory = std::move(value);
+      } else if (key == "file") {
+        commands.back().file = std::move(value);
+      } else if (key == "output") {
+        commands.back().output = std::move(value);
+      } else if (key == "command" && commands.back().output.empty()) {
+        commands.back().output = output_of(value);
+      }
+    }
+  }
+
+  return commands;
+}
+
+// Prerequisites listed in a Makefile-style depfile, as GCC and Clang write
+// them next to the object files. Empty if there is no such file.
+inline std::vector<std::string> read_depfile(const std::string &path) {
+  std::ifstream in{path};
+  const std::string text{std::istreambuf_iterator<char>{in}, {}};
+
+  std::vector<std::string> files;
+  const auto colon = text.find(": ");
+  if (colon == std::string::npos) {
+    return files;
+  }
+
+  std::string current;
+  for (size_t pos = colon + 2; pos <= text.size(); ++pos) {
+    const char c = pos < text.size() ? text[pos] : ' ';
+    if (c == '\\' && pos + 1 < text.size() && text[pos + 1] == ' ') {
+      current.push_back(' ');
+      ++pos;
+    } else if (c == ' ' || c == '\n' || c == '\r' || c == '\\') {
+      if (not current.empty()) {
+        files.push_back(std::move(current));
+        current.clear();
+      }
+    } else {
+      current.push_back(c);
+    }
+  }
+
+  return files;
+}
+
+// Paths that are looked up by base name first, so matching a file doesn't
+// compare it against every path in the set
+class FileSet {
+public:
+  void add(std::string file) {
+    files.push_back(std::move(file));
+    by_name.emplace(base_name(files.back()), files.size() - 1);
+  }
+
+  // Calls fn with the index of every added path that names the same file
+  template <typename Fn>
+  void for_each_match(std::string_view file, Fn &&fn) const {
+    const auto range = by_name.equal_range(base_name(file));
+    for (auto it = range.first; it != range.second; ++it) {
+      if (same_file(files[it->second], file)) {
+        fn(it->second);
+      }
+    }
+  }
+
+  [[nodiscard]] bool contains(std::string_view file) const {
+    bool found = false;
+    for_each_match(file, [&found](size_t /*index*/) { found = true; });
+    return found;
+  }
+
+private:
+  // A deque never moves its elements, so the views into them stay valid
+  std::deque<std::string> files{};
+  std::unordered_multimap<std::string_view, size_t> by_name{};
+};
+
+// Changed files, e.g. from `git diff --name-only`, and the translation units
+// that include one of them. The map only knows the test TUs, so a change it
+// can't trace to them affects everything: a changed TU that isn't in the map,
+// like a separately compiled lib.cpp, a TU outside the map whose depfile
+// lists a changed header, and a changed file that neither the map nor any
+// depfile lists.
+class AffectedFiles {
+public:
+  AffectedFiles(const std::vector<std::string> &changed,
+                const std::string &compile_commands_path,
+                const FileSet &mapped) {
+    std::vector<bool> known(changed.size());
+    for (size_t i = 0; i < changed.size(); ++i) {
+      files.add(changed[i]);
+      known[i] = mapped.contains(changed[i]);
+    }
+
+    const auto commands = compile_commands_path.empty()
+                              ? std::vector<CompileCommand>{}
+                              : read_compile_commands(compile_commands_path);
+    for (const auto &command : commands) {
+      const auto tu = absolute(command.directory, command.file);
+      if (contains(tu)) {
+        everything = everything || not mapped.contains(tu);
+        continue;
+      }
+      if (command.output.empty()) {
+        continue;
+      }
+
+      const auto object = absolute(command.directory, command.output);
+      auto dependencies = read_depfile(object + ".d");
+      if (dependencies.empty()) {
+        // Without -MF, -MD replaces the extension of the object file
+        dependencies =
+            read_depfile(object.substr(0, object.find_last_of('.')) + ".d");
+      }
+      // Later indices are the TUs added below, not changed files
+      bool includes_changed = false;
+      for (const auto &dependency : dependencies) {
+        files.for_each_match(dependency, [&](size_t index) {
+          includes_changed = true;
+          if (index < known.size()) {
+            known[index] = true;
+          }
+        });
+      }
+      if (includes_changed) {
+        everything = everything || not mapped.contains(tu);
+        files.add(tu);
+      }
+    }
+
+    everything = everything || std::ranges::find(known, false) != known.end();
+  }
+
+  [[nodiscard]] bool contains(std::string_view file) const {
+    return files.contains(file);
+  }
+
+  // Whether the change may affect any test
+  [[nodiscard]] bool affects_everything() const { return everything; }
+
+private:
+  static std::string absolute(const std::string &directory,
+                              const std::string &file) {
+    if (file.empty() || file.front() == '/' || directory.empty()) {
+      return file;
+    }
+    return directory + '/' + file;
+  }
+
+  FileSet files{};
+  bool everything = false;
+};
+
+// Selection of the tests affected by a change. It works per test TU: a test
+// is affected if one of its recorded files is, i.e. the TU it's defined in
+// or a file of its asserts, and tests without an entry in the map always
+// are. If the change can't be traced to test TUs, see AffectedFiles, or
+// without both a map and a list of changed files, every test is affected.
+class ChangeFilter {
+public:
+  explicit ChangeFilter(const Options &opts) {
+    if (opts.deps_file.empty() || opts.changed_files.empty()) {
+      return;
+    }
+
+    FileSet mapped;
+    std::ifstream deps{opts.deps_file};
+    std::string line;
+    while (std::getline(deps, line)) {
+      const auto tab = line.find('\t');
+      if (tab != std::string::npos) {
+        tests[line.substr(0, tab)].push_back(line.substr(tab + 1));
+        mapped.add(line.substr(tab + 1));
+      }
+    }
+
+    std::ifstream file;
+    if (opts.changed_files != "-") {
+      file.open(opts.changed_files);
+      if (not file) {
+        usage_error("--changed-files", "could not open the file");
+      }
+    }
+
+    std::vector<std::string> changed;
+    std::istream &in = file.is_open() ? file : std::cin;
+    while (std::getline(in, line)) {
+      if (not line.empty()) {
+        changed.push_back(line);
+      }
+    }
+
+    affected.emplace(changed, opts.compile_commands, mapped);
+  }
+
+  [[nodiscard]] bool affected_test(std::string_view name) const {
+    if (not affected || affected->affects_everything()) {
+      return true;
+    }
+
+    const auto it = tests.find(name);
+    if (it == tests.end()) {
+      return true;
+    }
+    for (const auto &file : it->second) {
+      if (affected->contains(file)) {
+        return true;
+      }
+    }
+    return false;
+  }
+
+private:
+  std::map<std::string, std::vector<std::string>, std::less<>> tests{};
+  std::optional<AffectedFiles> affected{};
+};
+
+inline const ChangeFilter &change_filter() {
+  static const ChangeFilter instance{options()};
+  return instance;
+}
+
+} // namespace testing::detail
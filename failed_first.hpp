@@ -0,0 +1,135 @@
+#pragma once
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
+#include <functional>
+#include <mutex>
+#include <set>
+#include <string>
+#include <string_view>
+#include <utility>
+#include <vector>
+
+#include "options.hpp"
+#include "output.hpp"
+
+namespace testing::detail {
+
+// Names of the tests that failed in the previous run, one per line of
+// options().failed_first_file. At exit or by testing::finish(), the file is
+// replaced with the tests that failed in this run, plus the previous failures
+// that didn't run, e.g. because fail-fast stopped the run first.
+class FailedFirst {
+public:
+  explicit FailedFirst(std::string _path) : path(std::move(_path)) {
+    if (path.empty()) {
+      return;
+    }
+
+    std::ifstream file{path};
+    std::string line;
+    while (std::getline(file, line)) {
+      if (not line.empty()) {
+        previous.insert(line);
+      }
+    }
+  }
+
+  FailedFirst(const FailedFirst &) = delete;
+  FailedFirst(FailedFirst &&) = delete;
+  FailedFirst &operator=(const FailedFirst &) = delete;
+  FailedFirst &operator=(FailedFirst &&) = delete;
+
+  ~FailedFirst() { write(); }
+
+  // Writing it again replaces it with the same names and any failed since
+  // Only in the runner, not by a forked worker that calls exit()
+  void write() {
+    std::lock_guard lock{mutex};
+    if (path.empty() || not recorded || not is_runner_process()) {
+      return;
+    }
+
+    std::FILE *file = std::fopen(path.c_str(), "w");
+    if (file == nullptr) {
+      std::fprintf(stderr, "Could not open failed-first file '%s'\n",
+                   path.c_str());
+      return;
+    }
+    for (const auto &name : previous) {
+      if (ran.find(name) == ran.end()) {
+        failed.insert(name);
+      }
+    }
+    for (const auto &name : failed) {
+      std::fprintf(file, "%s\n", name.c_str());
+    }
+    std::fclose(file);
+  }
+
+  [[nodiscard]] bool failed_before(std::string_view name) const {
+    return previous.find(name) != previous.end();
+  }
+
+  // Moves the indices of previously failed tests to the front, keeping the
+  // order within both groups
+  template <typename NameOf>
+  void reorder(std::vector<size_t> &indices, NameOf &&name_of) const {
+    if (not previous.empty()) {
+      std::stable_partition(indices.begin(), indices.end(),
+                            [this, &name_of](size_t i) {
+                              return failed_before(name_of(i));
+                            });
+    }
+  }
+
+  // Notes the tests of one report, each entry of `durations` has a name and
+  // whether it passed
+  template <typename Durations> void record(const Durations &durations) {
+    if (path.empty()) {
+      return;
+    }
+
+    std::lock_guard lock{mutex};
+    recorded = true;
+    for (const auto &entry : durations) {
+      ran.emplace(entry.name);
+      if (not entry.passed) {
+        failed.emplace(entry.name);
+      }
+    }
+  }
+
+private:
+  using NameSet = std::set<std::string, std::less<>>;
+
+  std::string path;
+  NameSet previous{};
+  std::mutex mutex{};
+  bool recorded = false;
+  NameSet ran{};
+  NameSet failed{};
+};
+
+inline FailedFirst &failed_first();
+
+inline void write_failed_first() { failed_first().write(); }
+
+// Also written by std::quick_exit, which skips the destructor
+inline FailedFirst &failed_first() {
+  static FailedFirst instance{options().failed_first_file};
+  // Registered once it's constructed, so it runs before the destructor
+  static const bool registered = []() {
+    static_cast<void>(is_runner_process());
+    std::atexit(write_failed_first);
+    std::at_quick_exit(write_failed_first);
+    return true;
+  }();
+  static_cast<void>(registered);
+  return instance;
+}
+
+} // namespace testing::detail
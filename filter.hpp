@@ -0,0 +1,121 @@
+#pragma once
+
+#include <cstddef>
+#include <optional>
+#include <regex>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "options.hpp"
+
+namespace testing::detail {
+
+// Whether the whole name matches a glob, where `*` matches any sequence of
+// characters and `?` any single one. Backtracks only to the last `*`, so it's
+// linear for patterns without several stars.
+constexpr bool glob_match(std::string_view pattern, std::string_view name) {
+  size_t p = 0;
+  size_t n = 0;
+  size_t star = std::string_view::npos;
+  size_t star_n = 0;
+
+  while (n < name.size()) {
+    if (p < pattern.size() && (pattern[p] == '?' || pattern[p] == name[n])) {
+      ++p;
+      ++n;
+    } else if (p < pattern.size() && pattern[p] == '*') {
+      star = p++;
+      star_n = n;
+    } else if (star != std::string_view::npos) {
+      p = star + 1;
+      n = ++star_n;
+    } else {
+      return false;
+    }
+  }
+
+  while (p < pattern.size() && pattern[p] == '*') {
+    ++p;
+  }
+  return p == pattern.size();
+}
+
+// Characters of a glob before its first wildcard
+constexpr std::string_view literal_prefix(std::string_view pattern) {
+  return pattern.substr(0, pattern.find_first_of("*?"));
+}
+
+// Selection of tests by name from options().filters, name_regex and excludes
+class NameFilter {
+public:
+  NameFilter(const std::vector<std::string> &_filters,
+             const std::string &name_regex,
+             const std::vector<std::string> &_excludes)
+      : filters(_filters), excludes(_excludes) {
+    if (name_regex.empty()) {
+      return;
+    }
+
+#ifdef __cpp_exceptions
+    try {
+      regex.emplace(name_regex);
+    } catch (const std::regex_error &e) {
+      usage_error("--regex", e.what());
+    }
+#else
+    regex.emplace(name_regex);
+#endif
+  }
+
+  [[nodiscard]] bool matches(std::string_view name) const {
+    for (const auto &exclude : excludes) {
+      if (glob_match(exclude, name)) {
+        return false;
+      }
+    }
+
+    if (filters.empty() && not regex) {
+      return true;
+    }
+    for (const auto &filter : filters) {
+      if (glob_match(filter, name)) {
+        return true;
+      }
+    }
+    return regex && std::regex_search(name.begin(), name.end(), *regex);
+  }
+
+  // Every selected name starts with one of these, so a sorted index can be
+  // searched for them instead of checking every name. None if any name may
+  // be selected.
+  [[nodiscard]] std::optional<std::vector<std::string_view>>
+  prefixes() const {
+    if (filters.empty() || regex) {
+      return std::nullopt;
+    }
+
+    std::vector<std::string_view> result;
+    for (const auto &filter : filters) {
+      const auto prefix = literal_prefix(filter);
+      if (prefix.empty()) {
+        return std::nullopt;
+      }
+      result.push_back(prefix);
+    }
+    return result;
+  }
+
+private:
+  std::vector<std::string> filters;
+  std::vector<std::string> excludes;
+  std::optional<std::regex> regex{};
+};
+
+inline const NameFilter &name_filter() {
+  static const NameFilter instance{options().filters, options().name_regex,
+                                   options().excludes};
+  return instance;
+}
+
+} // namespace testing::detail
@@ -0,0 +1,530 @@
+#pragma once
+
+#include <algorithm>
+#include <array>
+#include <cerrno>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <deque>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+#include "allocations.hpp"
+#include "arena.hpp"
+#include "config.hpp"
+#include "options.hpp"
+#include "output.hpp"
+#include "perf.hpp"
+#include "reporter.hpp"
+
+#ifdef TESTING_HAS_FORK
+#include <poll.h>
+#include <signal.h>
+#include <sys/socket.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#endif
+
+namespace testing::detail {
+
+// What a worker process reports about one job. The message is stored in this
+// process's message arena.
+struct JobRecord {
+  bool passed = false;
+  std::chrono::nanoseconds duration{};
+  std::string_view message{};
+  bool skipped = false; // Not run, because too many jobs failed
+  std::optional<AllocationCounts> allocations{};
+  std::optional<PerfCounts> counters{};
+};
+
+// Limits of forked jobs. A zero timeout or max_failures means unlimited.
+struct JobLimits {
+  std::chrono::nanoseconds job_timeout{};
+  std::chrono::steady_clock::time_point deadline =
+      std::chrono::steady_clock::time_point::max();
+  size_t max_failures = 0;
+};
+
+// Output buffered before forking, by the runner or the reporter, would
+// otherwise be written again by every worker
+inline void flush_before_fork() {
+  output().flush();
+  if (const auto &instance = reporter()) {
+    instance->flush();
+  }
+  std::fflush(nullptr);
+}
+
+inline std::string timeout_message(std::chrono::nanoseconds elapsed) {
+  char buffer[128];
+  std::snprintf(buffer, sizeof(buffer),
+                "ERROR: Test timed out after %.3f seconds\n",
+                std::chrono::duration<double>(elapsed).count());
+  return buffer;
+}
+
+#ifdef TESTING_HAS_FORK
+
+// Fixed part of a record on the socket, followed by message_size bytes. Both
+// sides run the same binary, so the layout is the same.
+struct RecordHeader {
+  size_t job = 0;
+  int64_t duration_ns = 0;
+  uint32_t message_size = 0;
+  uint8_t passed = 0;
+  uint8_t has_allocations = 0;
+  uint8_t has_counters = 0;
+  AllocationCounts allocations{};
+  PerfCounts counters{};
+};
+
+inline bool send_all(int fd, const void *data, size_t size) {
+  const auto *bytes = static_cast<const char *>(data);
+  while (size > 0) {
+    const ssize_t sent = ::send(fd, bytes, size, MSG_NOSIGNAL);
+    if (sent < 0 && errno == EINTR) {
+      continue;
+    }
+    if (sent <= 0) {
+      return false;
+    }
+    bytes += sent;
+    size -= static_cast<size_t>(sent);
+  }
+  return true;
+}
+
+inline bool recv_all(int fd, void *data, size_t size) {
+  auto *bytes = static_cast<char *>(data);
+  while (size > 0) {
+    const ssize_t received = ::recv(fd, bytes, size, 0);
+    if (received < 0 && errno == EINTR) {
+      continue;
+    }
+    if (received <= 0) {
+      return false;
+    }
+    bytes += received;
+    size -= static_cast<size_t>(received);
+  }
+  return true;
+}
+
+// A describing message for a worker that died while running a job
+inline std::string crash_message(int status) {
+  char buffer[128];
+  if (WIFSIGNALED(status)) {
+    std::snprintf(buffer, sizeof(buffer),
+                  "ERROR: Test crashed with signal %d (%s)\n", WTERMSIG(status),
+                  strsignal(WTERMSIG(status)));
+  } else {
+    std::snprintf(buffer, sizeof(buffer),
+                  "ERROR: Test exited the process with status %d\n",
+                  WEXITSTATUS(status));
+  }
+  return buffer;
+}
+
+// Runs jobs in a pool of forked worker processes. Every worker gets batches
+// of consecutive jobs over a socket and answers with one binary record per
+// job. If a worker dies, the job it was running fails, the rest of its batch
+// is requeued, and a new worker is forked. The parent also enforces the
+// limits: a worker running a job for too long is killed, and once the
+// deadline has passed, all of them are. After max_failures failed jobs, the
+// busy workers are killed too and the remaining jobs are skipped. Records
+// are passed to report in job order, each as soon as it and all before it
+// have come in.
+template <typename Run, typename Report> class ForkedPool {
+public:
+  ForkedPool(size_t _job_count, size_t worker_count, JobLimits _limits,
+             Run &_run, Report &_report)
+      : job_count(_job_count), limits(_limits), run(_run), report(_report),
+        records(_job_count), complete(_job_count) {
+    // Small batches balance the load, large ones save round trips
+    const size_t batch_size =
+        std::clamp<size_t>(job_count / (std::max<size_t>(worker_count, 1) * 4),
+                           1, 64);
+    for (size_t begin = 0; begin < job_count; begin += batch_size) {
+      batches.emplace_back(begin, std::min(begin + batch_size, job_count));
+    }
+
+    workers.resize(std::min(std::max<size_t>(worker_count, 1), batches.size()));
+  }
+
+  ForkedPool(const ForkedPool &) = delete;
+  ForkedPool(ForkedPool &&) = delete;
+  ForkedPool &operator=(const ForkedPool &) = delete;
+  ForkedPool &operator=(ForkedPool &&) = delete;
+  ~ForkedPool() = default;
+
+  void run_all() {
+    for (auto &worker : workers) {
+      spawn(worker);
+      assign(worker);
+    }
+
+    std::vector<pollfd> fds;
+    while (true) {
+      fds.clear();
+      for (const auto &worker : workers) {
+        if (worker.socket >= 0) {
+          fds.push_back({worker.socket, POLLIN, 0});
+        }
+      }
+      if (fds.empty()) {
+        break;
+      }
+
+      if (::poll(fds.data(), fds.size(), poll_timeout()) < 0) {
+        continue; // Interrupted by a signal
+      }
+
+      for (auto &worker : workers) {
+        if (worker.socket >= 0 && is_readable(fds, worker.socket)) {
+          receive(worker);
+        }
+      }
+      enforce_limits();
+    }
+
+    // Only left if a limit was reached or no worker could be forked
+    for (const auto &[begin, end] : batches) {
+      for (size_t job = begin; job < end; ++job) {
+        records[job].skipped = stopped;
+        records[job].message =
+            expired ? "ERROR: Not run, the suite timed out\n"
+                    : "ERROR: No worker process could run the test\n";
+        complete[job] = true;
+      }
+    }
+    report_completed();
+  }
+
+private:
+  struct Worker {
+    pid_t pid = -1;
+    int socket = -1;
+    size_t next = 0; // Next job of the current batch
+    size_t end = 0;
+    std::chrono::steady_clock::time_point job_start{};
+    bool killed = false; // For running out of time
+    std::string received{};
+  };
+
+  // Reports the records that are next in job order
+  void report_completed() {
+    while (next_report < job_count && complete[next_report]) {
+      report(next_report, records[next_report]);
+      ++next_report;
+    }
+  }
+
+  [[nodiscard]] bool is_busy(const Worker &worker) const {
+    return worker.socket >= 0 && worker.next < worker.end;
+  }
+
+  // Milliseconds until the next limit is reached, or -1 for none
+  [[nodiscard]] int poll_timeout() const {
+    auto next_limit = limits.deadline;
+    if (limits.job_timeout.count() > 0) {
+      for (const auto &worker : workers) {
+        if (is_busy(worker) && not worker.killed) {
+          next_limit = std::min(next_limit,
+                                worker.job_start + limits.job_timeout);
+        }
+      }
+    }
+    if (next_limit == std::chrono::steady_clock::time_point::max()) {
+      return -1;
+    }
+
+    const auto remaining = std::chrono::ceil<std::chrono::milliseconds>(
+        next_limit - std::chrono::steady_clock::now());
+    return static_cast<int>(
+        std::clamp<std::chrono::milliseconds::rep>(remaining.count(), 0,
+                                                   1000 * 1000));
+  }
+
+  // Kills the workers whose job took too long. Their EOF is then handled by
+  // receive() like a crash.
+  void enforce_limits() {
+    const auto now = std::chrono::steady_clock::now();
+    expired = expired || now >= limits.deadline;
+
+    for (auto &worker : workers) {
+      const bool too_long = limits.job_timeout.count() > 0 &&
+                            now >= worker.job_start + limits.job_timeout;
+      if (is_busy(worker) && not worker.killed && (expired || too_long)) {
+        ::kill(worker.pid, SIGKILL);
+        worker.killed = true;
+      }
+    }
+  }
+
+  void count_failure() {
+    failures += 1;
+    if (limits.max_failures == 0 || failures < limits.max_failures ||
+        stopped) {
+      return;
+    }
+
+    stopped = true;
+    for (auto &worker : workers) {
+      if (is_busy(worker)) {
+        ::kill(worker.pid, SIGKILL);
+      }
+    }
+  }
+
+  static bool is_readable(const std::vector<pollfd> &fds, int socket) {
+    return std::any_of(fds.begin(), fds.end(), [socket](const pollfd &fd) {
+      return fd.fd == socket && fd.revents != 0;
+    });
+  }
+
+  void spawn(Worker &worker) {
+    int sockets[2];
+    if (::socketpair(AF_UNIX, SOCK_STREAM, 0, sockets) != 0) {
+      std::perror("socketpair");
+      return;
+    }
+
+    flush_before_fork();
+
+    const pid_t pid = ::fork();
+    if (pid == 0) {
+      ::close(sockets[0]);
+      // Other workers only see EOF if no one else holds their sockets
+      for (const auto &other : workers) {
+        if (other.socket >= 0) {
+          ::close(other.socket);
+        }
+      }
+      if (options().perf_counters) {
+        perf_events().reopen();
+      }
+      work(sockets[1]);
+    }
+
+    ::close(sockets[1]);
+    if (pid < 0) {
+      std::perror("fork");
+      ::close(sockets[0]);
+      return;
+    }
+
+    worker = Worker{};
+    worker.pid = pid;
+    worker.socket = sockets[0];
+  }
+
+  [[noreturn]] void work(int socket) {
+    std::array<size_t, 2> batch{};
+    while (recv_all(socket, batch.data(), sizeof(batch))) {
+      for (size_t job = batch[0]; job < batch[1]; ++job) {
+        const auto record = run(job);
+
+        RecordHeader header;
+        header.job = job;
+        header.duration_ns = static_cast<int64_t>(record.duration.count());
+        header.message_size = static_cast<uint32_t>(record.message.size());
+        header.passed = record.passed ? 1 : 0;
+        if (record.allocations) {
+          header.has_allocations = 1;
+          header.allocations = *record.allocations;
+        }
+        if (record.counters) {
+          header.has_counters = 1;
+          header.counters = *record.counters;
+        }
+        if (not send_all(socket, &header, sizeof(header)) ||
+            not send_all(socket, record.message.data(),
+                         record.message.size())) {
+          ::_exit(1);
+        }
+      }
+    }
+
+    std::fflush(nullptr);
+    ::_exit(0);
+  }
+
+  // Sends the next batch, or tells an idle worker to exit if there's none
+  void assign(Worker &worker) {
+    if (worker.socket < 0) {
+      return;
+    }
+
+    if (batches.empty() || expired || stopped) {
+      ::shutdown(worker.socket, SHUT_WR);
+      return;
+    }
+
+    const auto [begin, end] = batches.front();
+    batches.pop_front();
+
+    worker.next = begin;
+    worker.end = end;
+    worker.job_start = std::chrono::steady_clock::now();
+
+    const std::array<size_t, 2> batch{{begin, end}};
+    if (not send_all(worker.socket, batch.data(), sizeof(batch))) {
+      // The worker is gone, its EOF is handled by receive()
+      ::shutdown(worker.socket, SHUT_WR);
+    }
+  }
+
+  void receive(Worker &worker) {
+    char buffer[64 * 1024];
+    const ssize_t size = ::recv(worker.socket, buffer, sizeof(buffer), 0);
+    if (size < 0 && errno == EINTR) {
+      return;
+    }
+    if (size <= 0) {
+      finish(worker);
+      return;
+    }
+
+    worker.received.append(buffer, static_cast<size_t>(size));
+
+    // Must not refer to `worker.received` across its erase
+    size_t offset = 0;
+    RecordHeader header;
+    while (worker.received.size() - offset >= sizeof(header)) {
+      std::memcpy(&header, worker.received.data() + offset, sizeof(header));
+      if (worker.received.size() - offset - sizeof(header) <
+          header.message_size) {
+        break;
+      }
+
+      auto &record = records[header.job];
+      record.passed = header.passed != 0;
+      record.duration = std::chrono::nanoseconds{header.duration_ns};
+      if (header.has_allocations != 0) {
+        record.allocations = header.allocations;
+      }
+      if (header.has_counters != 0) {
+        record.counters = header.counters;
+      }
+      record.message = message_arena().store(
+          {worker.received.data() + offset + sizeof(header),
+           header.message_size});
+      offset += sizeof(header) + header.message_size;
+      complete[header.job] = true;
+      if (not record.passed) {
+        count_failure();
+      }
+
+      worker.next = header.job + 1;
+      worker.job_start = std::chrono::steady_clock::now();
+      if (worker.next == worker.end) {
+        assign(worker);
+      }
+    }
+    worker.received.erase(0, offset);
+    report_completed();
+  }
+
+  // Reaps a worker whose socket was closed. If it died during a batch, the
+  // running job failed and the rest of the batch goes to a new worker.
+  void finish(Worker &worker) {
+    ::close(worker.socket);
+    worker.socket = -1;
+
+    int status = 0;
+    while (::waitpid(worker.pid, &status, 0) < 0 && errno == EINTR) {
+    }
+
+    if (worker.next >= worker.end) {
+      return;
+    }
+
+    // Killed because of max_failures, or died after that was reached
+    if (stopped) {
+      for (size_t job = worker.next; job < worker.end; ++job) {
+        records[job].skipped = true;
+        complete[job] = true;
+      }
+      worker.next = worker.end;
+      report_completed();
+      return;
+    }
+
+    auto &record = records[worker.next];
+    record.passed = false;
+    record.duration = std::chrono::steady_clock::now() - worker.job_start;
+    record.message = message_arena().store(
+        worker.killed ? timeout_message(record.duration)
+                      : crash_message(status));
+    complete[worker.next] = true;
+
+    if (worker.next + 1 < worker.end) {
+      batches.emplace_front(worker.next + 1, worker.end);
+    }
+    worker.next = worker.end;
+    count_failure();
+    report_completed();
+
+    if (not batches.empty() && not expired && not stopped) {
+      spawn(worker);
+      assign(worker);
+    }
+  }
+
+  size_t job_count;
+  JobLimits limits;
+  bool expired = false; // The deadline has passed
+  size_t failures = 0;
+  bool stopped = false; // max_failures was reached
+  Run &run;
+  Report &report;
+  std::vector<JobRecord> records;
+  std::vector<bool> complete;
+  size_t next_report = 0;
+  std::deque<std::pair<size_t, size_t>> batches{};
+  std::vector<Worker> workers{};
+};
+
+// Runs `run(job)` for every job in [0, job_count) in worker processes, and
+// calls `report(job, record)` for each in job order as the records come in
+template <typename Run, typename Report>
+void run_forked(size_t job_count, size_t worker_count, JobLimits limits,
+                Run &&run, Report &&report) {
+  ForkedPool<std::remove_reference_t<Run>, std::remove_reference_t<Report>>
+      pool{job_count, worker_count, limits, run, report};
+  pool.run_all();
+}
+
+#else
+
+// Without fork(), the jobs run in this process and the time limits are up to
+// `run`
+template <typename Run, typename Report>
+void run_forked(size_t job_count, size_t /*worker_count*/, JobLimits limits,
+                Run &&run, Report &&report) {
+  size_t failures = 0;
+  for (size_t job = 0; job < job_count; ++job) {
+    if (limits.max_failures > 0 && failures >= limits.max_failures) {
+      report(job, JobRecord{false, {}, {}, true});
+      continue;
+    }
+
+    auto result = run(job);
+    report(job, JobRecord{result.passed, result.duration, result.message, false,
+                          result.allocations, result.counters});
+    failures += result.passed ? 0 : 1;
+  }
+}
+
+#endif
+
+} // namespace testing::detail
@@ -1,10 +1,22 @@
+#include <atomic>
+#include <chrono>
+#include <filesystem>
 #include <thread>
 
+#include "allocations.hpp"
 #include "asserts.hpp"
+#include "bench.hpp"
+#include "bulk_asserts.hpp"
+#include "cases.hpp"
+#include "property.hpp"
+#include "stress.hpp"
 #include "test.hpp"
 
 using namespace testing;
 
+// Counts the allocations of every test, see below
+TESTING_DEFINE_ALLOCATION_TRACKER();
+
 constexpr void add() { assert_eq(1 + 1, 2); }
 
 constexpr void complex() { assert_eq(1, 1); }
@@ -35,6 +47,68 @@ struct Fixture {
 
 constexpr size_t increment(size_t a) { return a + 1; }
 
+void increment_in_loop() {
+  size_t value = 0;
+  for (size_t i = 0; i < 100; ++i) {
+    // Keeps the loop from being folded into a single addition
+    do_not_optimize(value += increment(i));
+  }
+  assert_eq(value, 5050u);
+}
+
+// Registered tests don't have to be listed anywhere, and can be defined in any
+// translation unit
+TEST_CASE(registered_add) { assert_eq(increment(1), 2u); }
+
+void increments(unsigned n) { assert_eq(increment(n), n + 1); }
+
+// Generated inputs, shrunk to the simplest failing ones if the property fails
+void increment_is_monotonic() {
+  check_property([](unsigned a) { assert_true(increment(a) > a); },
+                 gen::integral<unsigned>(0, 1000));
+}
+
+// Whole buffers at once, listing the first mismatches on failure
+void increments_all() {
+  std::array<unsigned, 4> values{{0, 1, 2, 3}};
+  std::ranges::transform(values, values.begin(), increment);
+  assert_all_eq(values, std::array<unsigned, 4>{{1, 2, 3, 4}});
+  assert_all_in_range(values, 1u, 4u);
+  assert_all_near(std::vector{0.1 + 0.2}, std::vector{0.3}, {.ulps = 1});
+}
+
+// Locks in that the hot path doesn't allocate
+void increments_without_allocating() {
+  size_t value = 0;
+  assert_no_allocations([&value]() { value = increment(value); });
+}
+
+// A suite that is reported after each of its lists writes every result to
+// the result file once, so the shard plan counts each test once. Counted
+// twice, a and b would take a shard each, and c would join one of them.
+void shard_plan_of_shared_suite() {
+  const auto path =
+      (std::filesystem::temp_directory_path() / "shared_suite_results.txt")
+          .string();
+  std::filesystem::remove(path);
+
+  TestSuite shared;
+  shared.add_duration("a", std::chrono::nanoseconds{100});
+  shared.add_duration("b", std::chrono::nanoseconds{100});
+  detail::write_partial_result(path, shared.take_unreported());
+  shared.add_duration("c", std::chrono::nanoseconds{150});
+  detail::write_partial_result(path, shared.take_unreported());
+
+  const detail::ShardPlan plan{path, 2};
+  std::filesystem::remove(path);
+  assert_eq(plan.shard_of("a", 2), plan.shard_of("b", 2));
+  assert_true(plan.shard_of("a", 2) != plan.shard_of("c", 2));
+}
+
+// Hit by several threads at once
+std::atomic<size_t> hits{0};
+void hit() { hits.fetch_add(1, std::memory_order_relaxed); }
+
 constexpr const char *what_is_it() { return "good"; }
 
 constexpr void using_verify() {
@@ -57,7 +131,10 @@ constexpr void using_verify() {
   [[maybe_unused]] auto twelve = 12u ^ 11_v;
 }
 
-int main() { // NOLINT: Exception escaping main is fine
+int main(int argc, char **argv) { // NOLINT: Exception escaping main is fine
+  // Reads --shard-index, --shard-count and --result-file
+  parse_args(argc, argv);
+
   TestSuite suite;
 
   int total = 0;
@@ -68,10 +145,43 @@ int main() { // NOLINT: Exception escaping main is fine
   total += TEST_ALL_SUITE_FIXTURE(suite, Fixture, &Fixture::add).fail_count;
   total += TEST_ALL_SUITE(suite, add).fail_count;
 
+  // Independent tests can run concurrently. They are still reported in order.
+  total += TEST_ALL_PARALLEL(add, takes_a_sec, using_verify).fail_count;
+  total += TEST_ALL_FIXTURE_PARALLEL(Fixture, &Fixture::add).fail_count;
+
+  // A suite that can be filled from several threads at once
+  ConcurrentTestSuite concurrent_suite;
+  total += TEST_ALL_SUITE_PARALLEL(concurrent_suite, add, using_verify)
+               .fail_count;
+
+  // Runs a test on several threads that start at the same time
+  total += STRESS(hit, 4, 1000, .yield_one_in = 8).fail_count;
+
+  // Runs every TEST_CASE of the program
+  total += TEST_ALL_REGISTERED().fail_count;
+
+  // Runs one test with every element of a range, e.g. the lines of a
+  // testing::MappedFile
+  total += TEST_CASES(increments, std::vector{0u, 1u, 41u}).fail_count;
+  total += TEST_ALL(increment_is_monotonic, increments_all,
+                    increments_without_allocating, shard_plan_of_shared_suite)
+               .fail_count;
+
+  // Benchmarks use the same functions as tests
+  total += BENCH_ALL(add, increment_in_loop).fail_count;
+  total += BENCH_ALL_FIXTURE(Fixture, &Fixture::add).fail_count;
+
   total += TEST_ALL_CONSTEXPR(add, complex, using_verify).fail_count;
   total += TEST_ALL_FIXTURE_CONSTEXPR(Fixture, &Fixture::add).fail_count;
 
+  // Constexpr tests are checked while compiling, the others run
+  total += TEST_ALL_AUTO(add, increment_in_loop).fail_count;
+
+  // Ends the report now, rather than in the exit handlers
+  testing::finish();
+
   assert_eq(total, 0);
 
-  return total;
+  // Skips the static destructors if a test that timed out still runs
+  testing::finish_and_exit(total);
 }
\ No newline at end of file
@@ -0,0 +1,130 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <iterator>
+#include <new>
+#include <span>
+#include <string>
+#include <string_view>
+#include <type_traits>
+#include <vector>
+
+#include "config.hpp"
+
+#ifdef TESTING_HAS_MMAP
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+namespace testing {
+
+// Read-only view of a whole file, e.g. the golden data of TEST_CASES. The
+// file is mapped into memory, so only the pages that are read get loaded.
+// Without mmap(), it's read into memory instead. A file that can't be opened
+// is reported and reads as empty.
+class MappedFile {
+public:
+  explicit MappedFile(const std::string &path) {
+#ifdef TESTING_HAS_MMAP
+    const int fd = ::open(path.c_str(), O_RDONLY); // NOLINT: C API
+    struct stat info {};
+    if (fd >= 0 && ::fstat(fd, &info) == 0) {
+      opened = true;
+      size = static_cast<size_t>(info.st_size);
+      if (size > 0) {
+        void *mapping = ::mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (mapping == MAP_FAILED) {
+          opened = false;
+          size = 0;
+        } else {
+          data = static_cast<const char *>(mapping);
+        }
+      }
+    }
+    if (fd >= 0) {
+      ::close(fd);
+    }
+#else
+    std::ifstream in{path, std::ios::binary};
+    if (in) {
+      opened = true;
+      const std::string bytes{std::istreambuf_iterator<char>{in}, {}};
+      // Aligned like the mappings are aligned, for records()
+      copy.resize((bytes.size() + sizeof(std::max_align_t) - 1) /
+                  sizeof(std::max_align_t));
+      if (not bytes.empty()) {
+        std::memcpy(copy.data(), bytes.data(), bytes.size());
+        data = reinterpret_cast<const char *>(copy.data());
+        size = bytes.size();
+      }
+    }
+#endif
+
+    if (not opened) {
+      std::fprintf(stderr, "Could not open data file '%s'\n", path.c_str());
+    }
+  }
+
+  MappedFile(const MappedFile &) = delete;
+  MappedFile(MappedFile &&) = delete;
+  MappedFile &operator=(const MappedFile &) = delete;
+  MappedFile &operator=(MappedFile &&) = delete;
+
+  ~MappedFile() {
+#ifdef TESTING_HAS_MMAP
+    if (data != nullptr) {
+      ::munmap(const_cast<char *>(data), size); // NOLINT: C API
+    }
+#endif
+  }
+
+  [[nodiscard]] bool is_open() const { return opened; }
+
+  [[nodiscard]] std::string_view contents() const { return {data, size}; }
+
+  // Every line without its line ending. A last line without one counts, too.
+  [[nodiscard]] std::vector<std::string_view> lines() const {
+    std::vector<std::string_view> result;
+    std::string_view rest = contents();
+    while (not rest.empty()) {
+      const auto end = rest.find('\n');
+      auto line = rest.substr(0, end);
+      if (line.ends_with('\r')) {
+        line.remove_suffix(1);
+      }
+      result.push_back(line);
+      rest.remove_prefix(end == std::string_view::npos ? rest.size() : end + 1);
+    }
+    return result;
+  }
+
+  // The file as an array of fixed-size records, e.g. one written from a
+  // std::vector<T>. Bytes after the last whole record are ignored. Mappings
+  // are page-aligned, and a copy is aligned for std::max_align_t, so T can't
+  // need more than that.
+  template <typename T>
+  requires std::is_trivially_copyable_v<T> &&
+      (alignof(T) <= alignof(std::max_align_t))
+  [[nodiscard]] std::span<const T> records() const {
+    if (data == nullptr) {
+      return {};
+    }
+    // NOLINTNEXTLINE: The bytes are the object representation of the records
+    return {std::launder(reinterpret_cast<const T *>(data)), size / sizeof(T)};
+  }
+
+private:
+  bool opened = false;
+  const char *data = nullptr;
+  size_t size = 0;
+#ifndef TESTING_HAS_MMAP
+  std::vector<std::max_align_t> copy{};
+#endif
+};
+
+} // namespace testing
@@ -0,0 +1,376 @@
+#pragma once
+
+#include <algorithm>
+#include <charconv>
+#include <chrono>
+#include <cstddef>
+#include <cstdio>
+#include <cstdlib>
+#include <string>
+#include <string_view>
+#include <system_error>
+#include <vector>
+
+namespace testing {
+
+// Formats of the structured report, see Reporter
+enum class ReportFormat { console, junit, json_lines, tap };
+
+// Runtime configuration shared by all runners
+struct Options {
+  // Only print the output of failed tests and the summaries
+  bool quiet = false;
+  // Number of slowest tests listed in the report. 0 disables the list.
+  size_t slowest_count = 5;
+
+  // Samples taken per benchmark
+  size_t bench_samples = 100;
+  // Minimum duration of one sample. The iteration count is calibrated to it.
+  std::chrono::nanoseconds bench_sample_time = std::chrono::milliseconds{1};
+  // File with the samples of a previous run that benchmarks are compared to
+  std::string bench_baseline{};
+  // Write this run's samples to bench_baseline instead of comparing
+  bool bench_update_baseline = false;
+  // A benchmark fails if its median is this much slower than the baseline...
+  double bench_regression_threshold = 0.05;
+  // ...and the Mann-Whitney p-value of the slowdown is below this
+  double bench_significance = 0.01;
+
+  // Only tests whose name matches one of these globs or name_regex are run,
+  // all tests if there are neither...
+  std::vector<std::string> filters{};
+  std::string name_regex{};
+  // ...and none whose name matches one of these globs
+  std::vector<std::string> excludes{};
+  // Print the names of the selected tests instead of running them
+  bool list_tests = false;
+
+  // Only run the tests affected by the files listed in changed_files, one per
+  // line or `-` for stdin, according to the dependency map in deps_file.
+  // Translation units that include a changed file, according to the
+  // depfiles of compile_commands, are affected too.
+  std::string deps_file{};
+  std::string changed_files{};
+  std::string compile_commands{};
+  // Write the dependency map of this run, which runs isolated tests in
+  // process, so their asserts can be seen
+  std::string write_deps_file{};
+
+  // Stop running tests after this many failures in the whole run. 0 never
+  // stops.
+  size_t fail_fast = 0;
+  // Tests that failed in the run that wrote this file run first in their
+  // list. The file is then replaced with this run's failures.
+  std::string failed_first_file{};
+
+  // Only tests whose name hash modulo shard_count is shard_index are run
+  size_t shard_index = 0;
+  size_t shard_count = 1;
+  // Result file of a previous run. Tests listed there are distributed over
+  // the shards by their duration instead of their name hash.
+  std::string timings_file{};
+  // Every report appends one line per test to this file, see
+  // detail::write_partial_result. Files of several shards can be concatenated.
+  std::string result_file{};
+
+  // Run the tests of TestTables and the registry in forked worker processes,
+  // so crashing tests only fail themselves
+  bool isolate = false;
+  // Number of worker processes for isolation. 0 uses one per core.
+  size_t isolation_workers = 0;
+
+  // A test running longer than this fails and the runner moves on. 0 is
+  // unlimited.
+  std::chrono::nanoseconds test_timeout{0};
+  // Same for a whole test list. Its tests that didn't run by then fail.
+  std::chrono::nanoseconds suite_timeout{0};
+
+  // Count hardware events like instructions around every test and benchmark
+  bool perf_counters = false;
+
+  // Inputs generated for every check_property
+  size_t property_cases = 100;
+  // Seed the inputs are generated from. 0 picks a new one every run, which
+  // failures print, so they can be reproduced with it.
+  size_t property_seed = 0;
+
+  // Directory of the files assert_matches_snapshot compares output to
+  std::string snapshot_dir = "snapshots";
+  // Write the output to the snapshots instead of failing if they differ
+  bool update_snapshots = false;
+
+  // Every result is also streamed to a reporter of this format...
+  ReportFormat report_format = ReportFormat::console;
+  // ...which writes to this file. Without one, the report replaces the
+  // console output on stdout.
+  std::string report_file{};
+};
+
+inline Options &options() {
+  static Options instance;
+  return instance;
+}
+
+namespace detail {
+
+[[noreturn]] inline void usage_error(std::string_view flag,
+                                     std::string_view message) {
+  std::fprintf(stderr, "Invalid %.*s: %.*s\n", static_cast<int>(flag.size()),
+               flag.data(), static_cast<int>(message.size()),
+               message.data());
+  std::exit(2); // NOLINT: Nothing to clean up yet
+}
+
+inline size_t parse_size(std::string_view flag, std::string_view value) {
+  size_t result = 0;
+  const auto [end, error] =
+      std::from_chars(value.data(), value.data() + value.size(), result);
+  if (error != std::errc{} || end != value.data() + value.size()) {
+    usage_error(flag, "expected a non-negative number");
+  }
+  return result;
+}
+
+inline std::chrono::nanoseconds parse_seconds(std::string_view flag,
+                                              std::string_view value) {
+  double seconds = 0.0;
+  const auto [end, error] =
+      std::from_chars(value.data(), value.data() + value.size(), seconds);
+  if (error != std::errc{} || end != value.data() + value.size() ||
+      seconds < 0.0) {
+    usage_error(flag, "expected a non-negative number of seconds");
+  }
+  return std::chrono::duration_cast<std::chrono::nanoseconds>(
+      std::chrono::duration<double>{seconds});
+}
+
+// A ratio like 0.05 for 5%, or a probability
+inline double parse_fraction(std::string_view flag, std::string_view value) {
+  double result = 0.0;
+  const auto [end, error] =
+      std::from_chars(value.data(), value.data() + value.size(), result);
+  if (error != std::errc{} || end != value.data() + value.size() ||
+      result < 0.0) {
+    usage_error(flag, "expected a non-negative number, e.g. 0.05");
+  }
+  return result;
+}
+
+// Appends the comma-separated items of value to list
+inline void append_list(std::vector<std::string> &list,
+                        std::string_view value) {
+  while (not value.empty()) {
+    const auto comma = std::min(value.find(','), value.size());
+    if (comma > 0) {
+      list.emplace_back(value.substr(0, comma));
+    }
+    value.remove_prefix(std::min(comma + 1, value.size()));
+  }
+}
+
+inline ReportFormat parse_report_format(std::string_view flag,
+                                        std::string_view value) {
+  if (value == "console") {
+    return ReportFormat::console;
+  }
+  if (value == "junit") {
+    return ReportFormat::junit;
+  }
+  if (value == "jsonl") {
+    return ReportFormat::json_lines;
+  }
+  if (value == "tap") {
+    return ReportFormat::tap;
+  }
+  usage_error(flag, "expected console, junit, jsonl or tap");
+}
+
+// Matches `--name=value` and `--name value`. For the latter, i is advanced
+// past the value. It fails if the next argument is missing or another flag,
+// so a value starting with "--" needs the first form.
+inline bool match_flag(std::string_view name, int argc,
+                       const char *const *argv, int &i,
+                       std::string_view &value) {
+  std::string_view arg = argv[i];
+  if (arg.substr(0, 2) != "--" || arg.substr(2, name.size()) != name) {
+    return false;
+  }
+
+  arg.remove_prefix(2 + name.size());
+  if (arg.empty()) {
+    if (i + 1 >= argc || std::string_view{argv[i + 1]}.substr(0, 2) == "--") {
+      usage_error(argv[i], "expected a value");
+    }
+    value = argv[++i];
+    return true;
+  }
+  if (not arg.empty() && arg.front() == '=') {
+    value = arg.substr(1);
+    return true;
+  }
+
+  return false;
+}
+
+inline bool match_switch(std::string_view name, std::string_view arg) {
+  return arg.substr(0, 2) == "--" && arg.substr(2) == name;
+}
+
+inline const char *env(const char *name) {
+  return std::getenv(name); // NOLINT: Only read at startup
+}
+
+} // namespace detail
+
+// Reads options from the environment and then the command line, which takes
+// precedence. Unknown arguments are ignored, so a program can have its own.
+//   --filter=GLOB,..., TESTING_FILTER       Run only tests matching a glob...
+//   --regex=REGEX                           ...or this regex...
+//   --exclude=GLOB,..., TESTING_EXCLUDE     ...but none matching these globs
+//   --list                                  List the tests instead of running
+//   --deps=PATH, TESTING_DEPS               Run only the tests affected by...
+//   --changed-files=PATH|-                  ...the files listed in PATH...
+//   --compile-commands=PATH                 ...and the TUs including them
+//   --write-deps=PATH                       Write the dependency map to PATH
+//   --fail-fast[=N]                         Stop after the first N failures
+//   --failed-first=PATH, TESTING_FAILED_FIRST
+//                                           Run the failures in PATH first
+//   --shard-index=N, TESTING_SHARD_INDEX    Run only the N-th shard...
+//   --shard-count=N, TESTING_SHARD_COUNT    ...of this many
+//   --result-file=PATH, TESTING_RESULT_FILE Write mergeable results to PATH
+//   --timings=PATH, TESTING_TIMINGS         Balance shards with these results
+//   --isolate                               Run tests in worker processes...
+//   --workers=N                             ...with this many workers
+//   --timeout=SECONDS                       Fail tests that take longer
+//   --suite-timeout=SECONDS                 Same for every test list
+//   --perf-counters                         Count instructions, cycles etc.
+//   --bench-baseline=PATH, TESTING_BENCH_BASELINE
+//                                           Compare benchmarks to PATH...
+//   --bench-update-baseline                 ...or write this run's samples
+//   --bench-threshold=RATIO                 Fail benchmarks slower by more...
+//   --bench-significance=P                  ...with a p-value below P
+//   --property-cases=N                      Inputs per property
+//   --seed=N, TESTING_SEED                  Seed of the property inputs
+//   --snapshot-dir=PATH, TESTING_SNAPSHOT_DIR
+//                                           Directory of the snapshots...
+//   --update-snapshots                      ...which are rewritten
+//   --reporter=FORMAT, TESTING_REPORTER     Stream results as console, junit,
+//                                           jsonl or tap...
+//   --report-file=PATH, TESTING_REPORT_FILE ...to PATH instead of stdout
+inline void parse_args(int argc, const char *const *argv) {
+  auto &opts = options();
+
+  if (const char *value = detail::env("TESTING_FILTER")) {
+    detail::append_list(opts.filters, value);
+  }
+  if (const char *value = detail::env("TESTING_EXCLUDE")) {
+    detail::append_list(opts.excludes, value);
+  }
+  if (const char *value = detail::env("TESTING_DEPS")) {
+    opts.deps_file = value;
+  }
+  if (const char *value = detail::env("TESTING_FAILED_FIRST")) {
+    opts.failed_first_file = value;
+  }
+  if (const char *value = detail::env("TESTING_SHARD_INDEX")) {
+    opts.shard_index = detail::parse_size("TESTING_SHARD_INDEX", value);
+  }
+  if (const char *value = detail::env("TESTING_SHARD_COUNT")) {
+    opts.shard_count = detail::parse_size("TESTING_SHARD_COUNT", value);
+  }
+  if (const char *value = detail::env("TESTING_RESULT_FILE")) {
+    opts.result_file = value;
+  }
+  if (const char *value = detail::env("TESTING_TIMINGS")) {
+    opts.timings_file = value;
+  }
+  if (const char *value = detail::env("TESTING_BENCH_BASELINE")) {
+    opts.bench_baseline = value;
+  }
+  if (const char *value = detail::env("TESTING_SEED")) {
+    opts.property_seed = detail::parse_size("TESTING_SEED", value);
+  }
+  if (const char *value = detail::env("TESTING_SNAPSHOT_DIR")) {
+    opts.snapshot_dir = value;
+  }
+  if (const char *value = detail::env("TESTING_REPORTER")) {
+    opts.report_format = detail::parse_report_format("TESTING_REPORTER", value);
+  }
+  if (const char *value = detail::env("TESTING_REPORT_FILE")) {
+    opts.report_file = value;
+  }
+
+  for (int i = 1; i < argc; ++i) {
+    std::string_view value;
+    if (detail::match_flag("filter", argc, argv, i, value)) {
+      detail::append_list(opts.filters, value);
+    } else if (detail::match_flag("regex", argc, argv, i, value)) {
+      opts.name_regex = value;
+    } else if (detail::match_flag("exclude", argc, argv, i, value)) {
+      detail::append_list(opts.excludes, value);
+    } else if (detail::match_switch("list", argv[i])) {
+      opts.list_tests = true;
+    } else if (detail::match_flag("deps", argc, argv, i, value)) {
+      opts.deps_file = value;
+    } else if (detail::match_flag("changed-files", argc, argv, i, value)) {
+      opts.changed_files = value;
+    } else if (detail::match_flag("compile-commands", argc, argv, i, value)) {
+      opts.compile_commands = value;
+    } else if (detail::match_flag("write-deps", argc, argv, i, value)) {
+      opts.write_deps_file = value;
+    } else if (detail::match_switch("fail-fast", argv[i])) {
+      opts.fail_fast = 1;
+    } else if (detail::match_flag("fail-fast", argc, argv, i, value)) {
+      opts.fail_fast = detail::parse_size("--fail-fast", value);
+    } else if (detail::match_flag("failed-first", argc, argv, i, value)) {
+      opts.failed_first_file = value;
+    } else if (detail::match_flag("shard-index", argc, argv, i, value)) {
+      opts.shard_index = detail::parse_size("--shard-index", value);
+    } else if (detail::match_flag("shard-count", argc, argv, i, value)) {
+      opts.shard_count = detail::parse_size("--shard-count", value);
+    } else if (detail::match_flag("result-file", argc, argv, i, value)) {
+      opts.result_file = value;
+    } else if (detail::match_flag("timings", argc, argv, i, value)) {
+      opts.timings_file = value;
+    } else if (detail::match_switch("isolate", argv[i])) {
+      opts.isolate = true;
+    } else if (detail::match_flag("workers", argc, argv, i, value)) {
+      opts.isolation_workers = detail::parse_size("--workers", value);
+    } else if (detail::match_flag("timeout", argc, argv, i, value)) {
+      opts.test_timeout = detail::parse_seconds("--timeout", value);
+    } else if (detail::match_flag("suite-timeout", argc, argv, i, value)) {
+      opts.suite_timeout = detail::parse_seconds("--suite-timeout", value);
+    } else if (detail::match_switch("perf-counters", argv[i])) {
+      opts.perf_counters = true;
+    } else if (detail::match_flag("bench-baseline", argc, argv, i, value)) {
+      opts.bench_baseline = value;
+    } else if (detail::match_switch("bench-update-baseline", argv[i])) {
+      opts.bench_update_baseline = true;
+    } else if (detail::match_flag("bench-threshold", argc, argv, i, value)) {
+      opts.bench_regression_threshold =
+          detail::parse_fraction("--bench-threshold", value);
+    } else if (detail::match_flag("bench-significance", argc, argv, i,
+                                  value)) {
+      opts.bench_significance =
+          detail::parse_fraction("--bench-significance", value);
+    } else if (detail::match_flag("property-cases", argc, argv, i, value)) {
+      opts.property_cases = detail::parse_size("--property-cases", value);
+    } else if (detail::match_flag("seed", argc, argv, i, value)) {
+      opts.property_seed = detail::parse_size("--seed", value);
+    } else if (detail::match_flag("snapshot-dir", argc, argv, i, value)) {
+      opts.snapshot_dir = value;
+    } else if (detail::match_switch("update-snapshots", argv[i])) {
+      opts.update_snapshots = true;
+    } else if (detail::match_flag("reporter", argc, argv, i, value)) {
+      opts.report_format = detail::parse_report_format("--reporter", value);
+    } else if (detail::match_flag("report-file", argc, argv, i, value)) {
+      opts.report_file = value;
+    }
+  }
+
+  if (opts.shard_count == 0 || opts.shard_index >= opts.shard_count) {
+    detail::usage_error("shard", "the index must be below the count");
+  }
+}
+
+} // namespace testing
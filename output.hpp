@@ -0,0 +1,87 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdio>
+#include <fmt/format.h>
+#include <mutex>
+#include <string_view>
+
+#include "config.hpp"
+
+#ifdef TESTING_HAS_FORK
+#include <unistd.h>
+#endif
+
+namespace testing::detail {
+
+// Whether this is the process that first called this. Forked workers inherit
+// the exit handlers and singletons of the runner, so the reports it writes at
+// exit check this first, and register after calling it.
+inline bool is_runner_process() {
+#ifdef TESTING_HAS_FORK
+  static const pid_t runner = ::getpid();
+  return ::getpid() == runner;
+#else
+  return true;
+#endif
+}
+
+// Collects the runner output and writes it to a file, stdout by default, in
+// large batches. Blocks are appended whole, so output of concurrently running
+// tests never interleaves.
+class Output {
+public:
+  static constexpr size_t flush_threshold = 64 * 1024;
+
+  Output() = default;
+  explicit Output(std::FILE *_file) : file(_file) {}
+  Output(const Output &) = delete;
+  Output(Output &&) = delete;
+  Output &operator=(const Output &) = delete;
+  Output &operator=(Output &&) = delete;
+
+  ~Output() { flush(); }
+
+  void write(std::string_view block) {
+    std::lock_guard lock{mutex};
+
+    batch.append(block.data(), block.data() + block.size());
+    if (batch.size() >= flush_threshold) {
+      flush_locked();
+    }
+  }
+
+  void flush() {
+    std::lock_guard lock{mutex};
+    flush_locked();
+  }
+
+private:
+  void flush_locked() {
+    if (batch.size() > 0) {
+      std::fwrite(batch.data(), 1, batch.size(), file);
+      std::fflush(file);
+      batch.clear();
+    }
+  }
+
+  std::FILE *file = stdout;
+  std::mutex mutex{};
+  fmt::memory_buffer batch{};
+};
+
+inline Output &output() {
+  static Output instance;
+  return instance;
+}
+
+// Scratch buffer that the output of one test is formatted into. It's reused
+// for every test on the same thread, so formatting doesn't allocate once it
+// has grown large enough.
+inline fmt::memory_buffer &block_buffer() {
+  thread_local fmt::memory_buffer buffer;
+  buffer.clear();
+  return buffer;
+}
+
+} // namespace testing::detail
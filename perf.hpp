@@ -0,0 +1,185 @@
+#pragma once
+
+#include <array>
+#include <cerrno>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <experimental/source_location>
+#include <functional>
+#include <string_view>
+
+#include "asserts.hpp"
+#include "config.hpp"
+#include "options.hpp"
+
+#ifdef TESTING_HAS_PERF_EVENTS
+#include <linux/perf_event.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+
+namespace testing {
+
+// Hardware events in user space. Unlike durations, instruction counts hardly
+// vary between runs, even on a busy machine.
+struct PerfCounts {
+  uint64_t cycles = 0;
+  uint64_t instructions = 0;
+  uint64_t cache_misses = 0;
+  uint64_t branch_misses = 0;
+};
+
+namespace detail {
+
+// Counters of the calling thread, opened once and then running until the
+// thread exits. A measurement is the difference of two reads, so they can
+// be nested, e.g. assert_max_instructions within a test that is measured.
+class PerfEvents {
+public:
+  PerfEvents() { open(); }
+
+  PerfEvents(const PerfEvents &) = delete;
+  PerfEvents(PerfEvents &&) = delete;
+  PerfEvents &operator=(const PerfEvents &) = delete;
+  PerfEvents &operator=(PerfEvents &&) = delete;
+
+  ~PerfEvents() { close(); }
+
+  [[nodiscard]] bool available() const { return fds[0] >= 0; }
+
+  // Why they aren't available
+  [[nodiscard]] std::string_view error_message() const { return error; }
+
+  [[nodiscard]] PerfCounts read() const {
+    std::array<uint64_t, event_count> values{};
+#ifdef TESTING_HAS_PERF_EVENTS
+    for (size_t i = 0; i < event_count; ++i) {
+      if (::read(fds[i], &values[i], sizeof(values[i])) !=
+          sizeof(values[i])) {
+        values[i] = 0;
+      }
+    }
+#endif
+    return {values[0], values[1], values[2], values[3]};
+  }
+
+  // A forked child inherits the counters, but they keep counting the thread
+  // of the parent that opened them
+  void reopen() {
+    close();
+    open();
+  }
+
+private:
+  static constexpr size_t event_count = 4;
+
+  void open() {
+#ifdef TESTING_HAS_PERF_EVENTS
+    constexpr std::array<uint64_t, event_count> events{
+        {PERF_COUNT_HW_CPU_CYCLES, PERF_COUNT_HW_INSTRUCTIONS,
+         PERF_COUNT_HW_CACHE_MISSES, PERF_COUNT_HW_BRANCH_MISSES}};
+    for (size_t i = 0; i < event_count; ++i) {
+      perf_event_attr attr{};
+      attr.type = PERF_TYPE_HARDWARE;
+      attr.size = sizeof(attr);
+      attr.config = events[i];
+      attr.exclude_kernel = 1;
+      attr.exclude_hv = 1;
+
+      // All in one group, so they're scheduled onto the PMU together
+      const long fd = ::syscall(SYS_perf_event_open, &attr, 0, -1,
+                                i == 0 ? -1 : fds[0], 0);
+      if (fd < 0) {
+        error = std::strerror(errno);
+        close();
+        return;
+      }
+      fds[i] = static_cast<int>(fd);
+    }
+    error = "";
+#endif
+  }
+
+  void close() {
+#ifdef TESTING_HAS_PERF_EVENTS
+    for (int &fd : fds) {
+      if (fd >= 0) {
+        ::close(fd);
+      }
+      fd = -1;
+    }
+#endif
+  }
+
+  std::array<int, event_count> fds{{-1, -1, -1, -1}};
+#ifdef TESTING_HAS_PERF_EVENTS
+  const char *error = "";
+#else
+  const char *error = "perf_event_open() isn't supported on this platform";
+#endif
+};
+
+inline PerfEvents &perf_events() {
+  thread_local PerfEvents events;
+  return events;
+}
+
+inline PerfCounts perf_counts_since(const PerfCounts &start) {
+  const auto now = perf_events().read();
+  return {now.cycles - start.cycles, now.instructions - start.instructions,
+          now.cache_misses - start.cache_misses,
+          now.branch_misses - start.branch_misses};
+}
+
+// Whether tests and benchmarks are measured, i.e. options().perf_counters is
+// set and the counters can be opened. If they can't, that's reported once.
+inline bool measuring_perf_counters() {
+  if (not options().perf_counters) {
+    return false;
+  }
+
+  const auto &events = perf_events();
+  if (not events.available()) {
+    static const bool warned = [&events]() {
+      std::fprintf(stderr, "Hardware counters aren't available: %.*s\n",
+                   static_cast<int>(events.error_message().size()),
+                   events.error_message().data());
+      return true;
+    }();
+    static_cast<void>(warned);
+  }
+  return events.available();
+}
+
+} // namespace detail
+
+// Fails if fn executes more instructions in user space than max. fn runs on
+// the calling thread, and the count includes everything it calls.
+template <typename Fn>
+requires std::invocable<Fn &>
+void assert_max_instructions(
+    uint64_t max, Fn &&fn,
+    const std::experimental::source_location location =
+        std::experimental::source_location::current()) {
+  detail::note_assert(location);
+  const auto &events = detail::perf_events();
+  if (not events.available()) {
+    detail::fail_with(location,
+                      "ERROR: Hardware counters aren't available: {}",
+                      events.error_message());
+    return;
+  }
+
+  const auto start = events.read();
+  std::invoke(fn);
+  const auto counts = detail::perf_counts_since(start);
+  if (counts.instructions > max) {
+    detail::fail_with(location,
+                      "ASSERT: Expected at most {} instructions, but there "
+                      "were {} in {} cycles",
+                      max, counts.instructions, counts.cycles);
+  }
+}
+
+} // namespace testing
@@ -0,0 +1,513 @@
+#pragma once
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <cmath>
+#include <concepts>
+#include <cstddef>
+#include <cstdint>
+#include <future>
+#include <limits>
+#include <numeric>
+#include <optional>
+#include <random>
+#include <string>
+#include <string_view>
+#include <tuple>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+#include "cases.hpp"
+#include "options.hpp"
+#include "thread_pool.hpp"
+
+namespace testing {
+
+// SplitMix64. It's small and fast to seed, so every generated case can have a
+// stream of its own.
+class Rng {
+public:
+  using result_type = uint64_t;
+
+  constexpr explicit Rng(uint64_t seed) : state(seed) {}
+
+  static constexpr result_type min() { return 0; }
+  static constexpr result_type max() {
+    return std::numeric_limits<result_type>::max();
+  }
+
+  constexpr result_type operator()() {
+    uint64_t z = (state += 0x9e3779b97f4a7c15ULL);
+    z = (z ^ (z >> 30U)) * 0xbf58476d1ce4e5b9ULL;
+    z = (z ^ (z >> 27U)) * 0x94d049bb133111ebULL;
+    return z ^ (z >> 31U);
+  }
+
+  // Uniform in [0, bound], without the bias of a plain modulo
+  constexpr uint64_t up_to(uint64_t bound) {
+    if (bound == max()) {
+      return (*this)();
+    }
+
+    const uint64_t range = bound + 1;
+    const uint64_t threshold = (max() - range + 1) % range;
+    uint64_t value = (*this)();
+    while (value < threshold) {
+      value = (*this)();
+    }
+    return value % range;
+  }
+
+  // Uniform in [0, 1)
+  constexpr double unit() {
+    return static_cast<double>((*this)() >> 11U) * 0x1.0p-53;
+  }
+
+  // True with a probability of 1 / n
+  constexpr bool one_in(uint64_t n) { return up_to(n - 1) == 0; }
+
+private:
+  uint64_t state;
+};
+
+// Produces random values for check_property, and simpler values that are
+// tried when one of them falsifies the property. Candidates come simplest
+// first.
+template <typename G>
+concept generator = requires(const G &gen, Rng &rng,
+                             const typename G::value_type &value) {
+  { gen.generate(rng) }
+  ->std::convertible_to<typename G::value_type>;
+  { gen.shrink(value) }
+  ->std::convertible_to<std::vector<typename G::value_type>>;
+};
+
+namespace gen {
+
+// Edge cases are rare in a uniform distribution, so generators pick them on
+// purpose once in this many values
+inline constexpr uint64_t edge_case_rate = 8;
+
+template <typename T>
+requires std::integral<T> && (sizeof(T) <= sizeof(uint64_t)) class Integral {
+public:
+  using value_type = T;
+
+  constexpr Integral(T _min, T _max) : min(_min), max(_max) {}
+
+  constexpr T generate(Rng &rng) const {
+    if (rng.one_in(edge_case_rate)) {
+      const std::array<T, 3> edges{{origin(), min, max}};
+      return edges[rng.up_to(edges.size() - 1)];
+    }
+    return moved(min, rng.up_to(distance(min, max)), true);
+  }
+
+  // The value itself minus its distance to the origin, halved over and over,
+  // so big steps are tried before small ones
+  [[nodiscard]] std::vector<T> shrink(T value) const {
+    std::vector<T> result;
+    const T target = origin();
+    const bool up = value < target;
+    for (uint64_t step = distance(value, target); step > 0; step /= 2) {
+      result.push_back(moved(value, step, up));
+    }
+    return result;
+  }
+
+  // The value closest to 0, which shrinking moves towards
+  [[nodiscard]] constexpr T origin() const {
+    if (min > T{}) {
+      return min;
+    }
+    if constexpr (std::is_signed_v<T>) {
+      if (max < T{}) {
+        return max;
+      }
+    }
+    return T{};
+  }
+
+private:
+  // Two's complement arithmetic in uint64_t can't overflow
+  static constexpr uint64_t distance(T lhs, T rhs) {
+    const auto low = static_cast<uint64_t>(std::min(lhs, rhs));
+    const auto high = static_cast<uint64_t>(std::max(lhs, rhs));
+    return high - low;
+  }
+
+  static constexpr T moved(T value, uint64_t step, bool up) {
+    const auto bits = static_cast<uint64_t>(value);
+    return static_cast<T>(up ? bits + step : bits - step);
+  }
+
+  T min;
+  T max;
+};
+
+template <std::floating_point T> class Floating {
+public:
+  using value_type = T;
+
+  constexpr Floating(T _min, T _max) : min(_min), max(_max) {}
+
+  constexpr T generate(Rng &rng) const {
+    if (rng.one_in(edge_case_rate)) {
+      const std::array<T, 3> edges{{origin(), min, max}};
+      return edges[rng.up_to(edges.size() - 1)];
+    }
+    // Unlike min + (max - min) * u, this can't overflow
+    const auto u = static_cast<T>(rng.unit());
+    return min * (1 - u) + max * u;
+  }
+
+  // The origin, the value without its fraction, then halfway there
+  [[nodiscard]] std::vector<T> shrink(T value) const {
+    std::vector<T> result;
+    for (const T candidate : {origin(), std::trunc(value),
+                              std::midpoint(origin(), value)}) {
+      const bool simpler =
+          std::abs(candidate - origin()) < std::abs(value - origin());
+      if (simpler && candidate >= min && candidate <= max) {
+        result.push_back(candidate);
+      }
+    }
+    return result;
+  }
+
+  [[nodiscard]] constexpr T origin() const {
+    return std::clamp(T{}, min, max);
+  }
+
+private:
+  T min;
+  T max;
+};
+
+// Printable ASCII, so failures are readable
+class String {
+public:
+  using value_type = std::string;
+
+  constexpr explicit String(size_t _max_size) : max_size(_max_size) {}
+
+  [[nodiscard]] std::string generate(Rng &rng) const {
+    std::string result(rng.up_to(max_size), ' ');
+    for (char &c : result) {
+      c = static_cast<char>(' ' + static_cast<int>(rng.up_to('~' - ' ')));
+    }
+    return result;
+  }
+
+  // Empty, either half, then every string with one character less
+  [[nodiscard]] std::vector<std::string>
+  shrink(const std::string &value) const {
+    std::vector<std::string> result;
+    if (value.empty()) {
+      return result;
+    }
+
+    const size_t half = value.size() / 2;
+    result.emplace_back();
+    if (half > 0) {
+      result.push_back(value.substr(0, half));
+      result.push_back(value.substr(half));
+    }
+    for (size_t i = 0; i < value.size(); ++i) {
+      result.push_back(value.substr(0, i) + value.substr(i + 1));
+    }
+    return result;
+  }
+
+private:
+  size_t max_size;
+};
+
+template <generator Element> class VectorOf {
+public:
+  using element_type = typename Element::value_type;
+  using value_type = std::vector<element_type>;
+
+  constexpr VectorOf(Element _element, size_t _max_size)
+      : element(std::move(_element)), max_size(_max_size) {}
+
+  [[nodiscard]] value_type generate(Rng &rng) const {
+    value_type result(rng.up_to(max_size));
+    for (auto &value : result) {
+      value = element.generate(rng);
+    }
+    return result;
+  }
+
+  // Shorter vectors like for strings, then every element shrunk in place
+  [[nodiscard]] std::vector<value_type> shrink(const value_type &value) const {
+    std::vector<value_type> result;
+    if (value.empty()) {
+      return result;
+    }
+
+    const auto half = static_cast<std::ptrdiff_t>(value.size() / 2);
+    result.emplace_back();
+    if (half > 0) {
+      result.emplace_back(value.begin(), value.begin() + half);
+      result.emplace_back(value.begin() + half, value.end());
+    }
+    for (size_t i = 0; i < value.size(); ++i) {
+      auto shorter = value;
+      shorter.erase(shorter.begin() + static_cast<std::ptrdiff_t>(i));
+      result.push_back(std::move(shorter));
+    }
+    for (size_t i = 0; i < value.size(); ++i) {
+      for (auto &candidate : element.shrink(value[i])) {
+        result.push_back(value);
+        result.back()[i] = std::move(candidate);
+      }
+    }
+    return result;
+  }
+
+private:
+  Element element;
+  size_t max_size;
+};
+
+template <std::integral T>
+constexpr Integral<T> integral(T min = std::numeric_limits<T>::lowest(),
+                               T max = std::numeric_limits<T>::max()) {
+  return {min, max};
+}
+
+// Unlike for integers, the whole range of a floating-point type would mostly
+// produce huge values, so the default is smaller
+template <std::floating_point T>
+constexpr Floating<T> floating(T min = -1e6, T max = 1e6) {
+  return {min, max};
+}
+
+constexpr String string(size_t max_size = 32) { return String{max_size}; }
+
+template <generator Element>
+constexpr VectorOf<Element> vector_of(Element element, size_t max_size = 32) {
+  return {std::move(element), max_size};
+}
+
+} // namespace gen
+
+namespace detail {
+
+// Shrinking stops after this many simplifications, even if more would work
+inline constexpr size_t max_shrink_steps = 1000;
+
+// Up to this many cases run on the calling thread, since starting a pool
+// costs more than the cases themselves usually do
+inline constexpr size_t max_inline_property_cases = 256;
+
+// options().property_seed, or one picked once per run
+inline uint64_t property_seed() {
+  static const uint64_t seed = []() -> uint64_t {
+    if (options().property_seed != 0) {
+      return options().property_seed;
+    }
+    std::random_device device;
+    return ((uint64_t{device()} << 32U) | device()) | 1U;
+  }();
+  return seed;
+}
+
+// Every case has its own stream, so its inputs don't depend on the thread
+// that generates them, and can be generated again from the seed and index
+inline Rng case_rng(uint64_t seed, size_t index) {
+  Rng mixer{seed ^ (index * 0x9e3779b97f4a7c15ULL)};
+  return Rng{mixer()};
+}
+
+template <generator... Gens>
+std::tuple<typename Gens::value_type...>
+generate_case(const std::tuple<Gens...> &gens, uint64_t seed, size_t index) {
+  auto rng = case_rng(seed, index);
+  // Braces, so the generators are called in order
+  return std::apply(
+      [&rng](const auto &...gen) {
+        return std::tuple<typename Gens::value_type...>{gen.generate(rng)...};
+      },
+      gens);
+}
+
+template <typename Fn, typename Args>
+std::optional<std::string_view> check_case(Fn &fn, const Args &args) {
+  auto call = [&fn](const Args &values) { std::apply(fn, values); };
+  return run_case(call, args);
+}
+
+inline void lower_to(std::atomic<size_t> &value, size_t candidate) {
+  size_t current = value.load(std::memory_order_relaxed);
+  while (candidate < current &&
+         not value.compare_exchange_weak(current, candidate,
+                                         std::memory_order_relaxed)) {
+  }
+}
+
+// Index of the first case that falsifies the property, so the reported case
+// doesn't depend on the scheduling. Batches skip the cases after a failure
+// that was already found. Without a pool, they all run on this thread.
+template <typename Fn, generator... Gens>
+std::optional<size_t> find_failure(ThreadPool *pool, size_t workers, Fn &fn,
+                                   const std::tuple<Gens...> &gens,
+                                   uint64_t seed, size_t cases) {
+  constexpr size_t none = std::numeric_limits<size_t>::max();
+  std::atomic<size_t> first_failure{none};
+
+  auto run_batch = [&fn, &gens, &first_failure, seed](size_t start,
+                                                      size_t end) {
+    for (size_t i = start; i < end; ++i) {
+      if (i > first_failure.load(std::memory_order_relaxed)) {
+        return;
+      }
+      if (check_case(fn, generate_case(gens, seed, i))) {
+        lower_to(first_failure, i);
+        return;
+      }
+    }
+  };
+
+  if (pool == nullptr) {
+    run_batch(0, cases);
+  } else {
+    const size_t batch_size = case_batch_size(cases, workers);
+    std::vector<std::future<void>> batches;
+    for (size_t start = 0; start < cases; start += batch_size) {
+      const size_t end = std::min(start + batch_size, cases);
+      batches.push_back(
+          pool->submit([&run_batch, start, end]() { run_batch(start, end); }));
+    }
+    for (auto &batch : batches) {
+      batch.get();
+    }
+  }
+
+  const size_t index = first_failure.load();
+  return index == none ? std::nullopt : std::optional{index};
+}
+
+// Every arguments tuple with one argument replaced by one of its shrinks
+template <generator... Gens, typename Args>
+std::vector<Args> shrink_candidates(const std::tuple<Gens...> &gens,
+                                    const Args &args) {
+  std::vector<Args> result;
+  [&]<size_t... Is>(std::index_sequence<Is...>) {
+    (
+        [&]() {
+          for (auto &value :
+               std::get<Is>(gens).shrink(std::get<Is>(args))) {
+            result.push_back(args);
+            std::get<Is>(result.back()) = std::move(value);
+          }
+        }(),
+        ...);
+  }
+  (std::index_sequence_for<Gens...>{});
+  return result;
+}
+
+// Replaces the arguments with simpler ones that still falsify the property,
+// until there are none. Candidates are checked concurrently, a few per
+// worker at a time, and the first failing one in order wins.
+template <typename Fn, generator... Gens, typename Args>
+size_t shrink_failure(ThreadPool &pool, size_t workers, Fn &fn,
+                      const std::tuple<Gens...> &gens, Args &args,
+                      std::string_view &message) {
+  size_t steps = 0;
+  while (steps < max_shrink_steps) {
+    const auto candidates = shrink_candidates(gens, args);
+
+    std::optional<size_t> simpler;
+    for (size_t start = 0; start < candidates.size() && not simpler;
+         start += 2 * workers) {
+      const size_t end = std::min(start + 2 * workers, candidates.size());
+      std::vector<std::future<std::optional<std::string_view>>> checks;
+      for (size_t i = start; i < end; ++i) {
+        checks.push_back(pool.submit([&fn, &candidate = candidates[i]]() {
+          return check_case(fn, candidate);
+        }));
+      }
+
+      for (size_t i = start; i < end; ++i) {
+        const auto failure = checks[i - start].get();
+        if (failure && not simpler) {
+          simpler = i;
+          message = *failure;
+        }
+      }
+    }
+
+    if (not simpler) {
+      break;
+    }
+    args = candidates[*simpler];
+    ++steps;
+  }
+  return steps;
+}
+
+// Fails the running test with a finished message, which already names the
+// location of the failed assertion
+TESTING_FAIL_NORETURN inline void fail_property(std::string_view message) {
+#ifdef TESTING_NO_EXCEPTIONS
+  auto &state = failure_state();
+  if (not state.failed) {
+    state.failed = true;
+    state.message = message;
+  }
+#else
+  throw AssertFailure{message};
+#endif
+}
+
+} // namespace detail
+
+// Calls fn with options().property_cases sets of generated arguments, one
+// from each generator. If one falsifies the property, i.e. fails an
+// assertion, it's shrunk to the simplest arguments that still do, and the
+// test fails with those. Cases and shrinks run on a thread pool, so fn must
+// be safe to call concurrently. Only more than max_inline_property_cases
+// cases start one, or a failure that is shrunk.
+template <typename Fn, generator... Gens>
+requires std::invocable<Fn &, const typename Gens::value_type &...>
+void check_property(Fn &&fn, Gens... gens) {
+  const auto all = std::tuple<Gens...>{std::move(gens)...};
+  const uint64_t seed = detail::property_seed();
+  const size_t cases = options().property_cases;
+  const size_t workers = detail::default_parallelism();
+  std::optional<detail::ThreadPool> pool;
+  if (cases > detail::max_inline_property_cases) {
+    pool.emplace(workers);
+  }
+
+  const auto index = detail::find_failure(pool ? &*pool : nullptr, workers,
+                                          fn, all, seed, cases);
+  if (not index) {
+    return;
+  }
+  if (not pool) {
+    pool.emplace(workers);
+  }
+
+  auto args = detail::generate_case(all, seed, *index);
+  std::string_view message = detail::check_case(fn, args).value_or("");
+  const size_t steps =
+      detail::shrink_failure(*pool, workers, fn, all, args, message);
+
+  detail::fail_property(std::apply(
+      [&](const auto &...values) {
+        return detail::format_message(
+            "PROPERTY: Falsified by case {} of {} (seed {}, shrunk {} times) "
+            "with arguments '{}':\n{}",
+            *index, cases, seed, steps, detail::printed_args(values...),
+            message);
+      },
+      args));
+}
+
+} // namespace testing
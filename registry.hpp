@@ -0,0 +1,87 @@
+#pragma once
+
+#include <algorithm>
+#include <cstddef>
+#include <mutex>
+#include <string_view>
+#include <vector>
+
+namespace testing {
+
+// A test registered with TEST_CASE
+struct RegisteredTest {
+  std::string_view name{};
+  void (*fn)() = nullptr;
+  std::string_view file{};
+};
+
+// All tests registered with TEST_CASE in any translation unit of the program.
+// Tests of one translation unit are in definition order, the order between
+// translation units is unspecified.
+class Registry {
+public:
+  bool add(RegisteredTest test) {
+    tests.push_back(test);
+    return true;
+  }
+
+  [[nodiscard]] size_t size() const { return tests.size(); }
+
+  [[nodiscard]] std::string_view name(size_t i) const { return tests[i].name; }
+
+  void invoke(size_t i) const { tests[i].fn(); }
+
+  [[nodiscard]] const std::vector<RegisteredTest> &entries() const {
+    return tests;
+  }
+
+  // Indices of the tests whose name starts with prefix, in name order. The
+  // name index is sorted on first use and after later registrations, so a
+  // lookup is a binary search.
+  [[nodiscard]] std::vector<size_t> with_prefix(std::string_view prefix) const {
+    std::lock_guard lock{index_mutex};
+    if (sorted.size() != tests.size()) {
+      sorted.resize(tests.size());
+      for (size_t i = 0; i < sorted.size(); ++i) {
+        sorted[i] = i;
+      }
+      std::stable_sort(sorted.begin(), sorted.end(),
+                       [this](size_t lhs, size_t rhs) {
+                         return tests[lhs].name < tests[rhs].name;
+                       });
+    }
+
+    auto first = std::lower_bound(
+        sorted.begin(), sorted.end(), prefix,
+        [this](size_t i, std::string_view key) { return tests[i].name < key; });
+    auto last = first;
+    while (last != sorted.end() && tests[*last].name.starts_with(prefix)) {
+      ++last;
+    }
+    return {first, last};
+  }
+
+private:
+  std::vector<RegisteredTest> tests{};
+  mutable std::mutex index_mutex{};
+  mutable std::vector<size_t> sorted{};
+};
+
+// Function-local, so it exists before the first registration no matter which
+// translation unit is initialized first
+inline Registry &registry() {
+  static Registry instance;
+  return instance;
+}
+
+} // namespace testing
+
+// Defines a test and registers it before main() runs. The test body follows:
+//   TEST_CASE(parses_numbers) { assert_eq(parse("1"), 1); }
+// Only this header and the asserts are needed to define tests, so they can be
+// spread over many translation units that are linked into one runner.
+#define TEST_CASE(name)                                                        \
+  static void name();                                                          \
+  [[maybe_unused]] static const bool testing_registered_##name =               \
+      testing::registry().add({#name, &name, __FILE__});                       \
+  static void name()
@@ -0,0 +1,425 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <cstdio>
+#include <cstdlib>
+#include <fmt/format.h>
+#include <iterator>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <utility>
+
+#include "allocations.hpp"
+#include "options.hpp"
+#include "output.hpp"
+#include "perf.hpp"
+
+namespace testing {
+
+// Outcome of running a single test. The message holds the assertion output
+// of a failed test and lives in the message arena. Allocations are only known
+// with TESTING_DEFINE_ALLOCATION_TRACKER, hardware counters with
+// options().perf_counters.
+struct TestResult {
+  std::string_view name{};
+  bool passed = false;
+  std::string_view message{};
+  std::chrono::nanoseconds duration{};
+  std::optional<AllocationCounts> allocations{};
+  std::optional<PerfCounts> counters{};
+};
+
+// Totals of one report() of a suite
+struct SuiteSummary {
+  int total = 0;
+  int failed = 0;
+  std::chrono::nanoseconds duration{};
+};
+
+// Receives every result as soon as its test finished, and the summary of a
+// suite when it's reported. Tests of a shared suite finish on several
+// threads, so both may be called concurrently.
+class Reporter {
+public:
+  Reporter() = default;
+  Reporter(const Reporter &) = delete;
+  Reporter(Reporter &&) = delete;
+  Reporter &operator=(const Reporter &) = delete;
+  Reporter &operator=(Reporter &&) = delete;
+  virtual ~Reporter() = default;
+
+  virtual void test_finished(const TestResult &result) = 0;
+  virtual void suite_finished(const SuiteSummary &summary) = 0;
+
+  // Writes what can only follow the last result, e.g. closing tags. Called
+  // by testing::finish() and at exit, so it must do nothing the second time.
+  virtual void finish() {}
+
+  // Writes what's buffered, e.g. before forking
+  virtual void flush() {}
+};
+
+namespace detail {
+
+inline void append(fmt::memory_buffer &buffer, std::string_view str) {
+  buffer.append(str.data(), str.data() + str.size());
+}
+
+// Control characters other than whitespace aren't allowed in XML 1.0
+inline void append_xml_escaped(fmt::memory_buffer &buffer,
+                               std::string_view str) {
+  for (char c : str) {
+    switch (c) {
+    case '&':
+      append(buffer, "&amp;");
+      break;
+    case '<':
+      append(buffer, "&lt;");
+      break;
+    case '>':
+      append(buffer, "&gt;");
+      break;
+    case '"':
+      append(buffer, "&quot;");
+      break;
+    case '\'':
+      append(buffer, "&apos;");
+      break;
+    default:
+      const bool control = static_cast<unsigned char>(c) < 0x20 &&
+                           c != '\t' && c != '\n' && c != '\r';
+      buffer.push_back(control ? '?' : c);
+    }
+  }
+}
+
+inline void append_json_escaped(fmt::memory_buffer &buffer,
+                                std::string_view str) {
+  for (char c : str) {
+    switch (c) {
+    case '"':
+      append(buffer, "\\\"");
+      break;
+    case '\\':
+      append(buffer, "\\\\");
+      break;
+    case '\n':
+      append(buffer, "\\n");
+      break;
+    case '\t':
+      append(buffer, "\\t");
+      break;
+    case '\r':
+      append(buffer, "\\r");
+      break;
+    default:
+      if (static_cast<unsigned char>(c) < 0x20) {
+        fmt::format_to(std::back_inserter(buffer), "\\u{:04x}",
+                       static_cast<unsigned>(c));
+      } else {
+        buffer.push_back(c);
+      }
+    }
+  }
+}
+
+inline double seconds(std::chrono::nanoseconds duration) {
+  return std::chrono::duration<double>(duration).count();
+}
+
+// Reporter that writes a text stream to a file, or to stdout if the path is
+// empty. A file is flushed after every write, so it can be read while the
+// tests run and keeps the results before a crash. On stdout, output is batched
+// like the console output and flushed after every suite.
+class StreamReporter : public Reporter {
+public:
+  StreamReporter(const StreamReporter &) = delete;
+  StreamReporter(StreamReporter &&) = delete;
+  StreamReporter &operator=(const StreamReporter &) = delete;
+  StreamReporter &operator=(StreamReporter &&) = delete;
+
+  ~StreamReporter() override {
+    out.flush();
+    if (file != stdout) {
+      std::fclose(file);
+    }
+  }
+
+  void flush() override { out.flush(); }
+
+protected:
+  explicit StreamReporter(const std::string &path) : file(open(path)) {}
+
+  void write(const fmt::memory_buffer &buffer) {
+    out.write({buffer.data(), buffer.size()});
+    if (file != stdout) {
+      out.flush();
+    }
+  }
+
+private:
+  static std::FILE *open(const std::string &path) {
+    if (path.empty()) {
+      return stdout;
+    }
+
+    std::FILE *opened = std::fopen(path.c_str(), "w");
+    if (opened == nullptr) {
+      std::fprintf(stderr, "Could not open report file '%s'\n", path.c_str());
+      return stdout;
+    }
+    return opened;
+  }
+
+  std::FILE *file;
+  Output out{file};
+};
+
+// All tests go into one <testsuite>, which is only closed by finish(). Its
+// totals aren't known before that, so they're left for the consumer to count.
+// A fixture's tests get the fixture as classname, the others the suite's name.
+class JUnitReporter final : public StreamReporter {
+public:
+  explicit JUnitReporter(const std::string &path) : StreamReporter(path) {
+    auto &buffer = block_buffer();
+    append(buffer, "<?xml version=\"1.0\" encoding=\"UTF-8\"?>\n<testsuites>\n"
+                   "<testsuite name=\"testing\">\n");
+    write(buffer);
+  }
+
+  JUnitReporter(const JUnitReporter &) = delete;
+  JUnitReporter(JUnitReporter &&) = delete;
+  JUnitReporter &operator=(const JUnitReporter &) = delete;
+  JUnitReporter &operator=(JUnitReporter &&) = delete;
+
+  ~JUnitReporter() override { finish(); }
+
+  // Thread-local buffers may already be gone at exit
+  void finish() override {
+    if (not is_runner_process() || finished.exchange(true)) {
+      return;
+    }
+    fmt::memory_buffer buffer;
+    append(buffer, "</testsuite>\n</testsuites>\n");
+    write(buffer);
+    flush();
+  }
+
+  void test_finished(const TestResult &result) override {
+    auto &buffer = block_buffer();
+    const auto [classname, name] = split_classname(result.name);
+    append(buffer, "  <testcase classname=\"");
+    append_xml_escaped(buffer, classname);
+    append(buffer, "\" name=\"");
+    append_xml_escaped(buffer, name);
+    fmt::format_to(std::back_inserter(buffer), "\" time=\"{:.6f}\"",
+                   seconds(result.duration));
+
+    if (result.passed) {
+      append(buffer, "/>\n");
+    } else {
+      append(buffer, ">\n    <failure message=\"");
+      append_xml_escaped(buffer,
+                         result.message.substr(0, result.message.find('\n')));
+      append(buffer, "\">");
+      append_xml_escaped(buffer, result.message);
+      append(buffer, "</failure>\n  </testcase>\n");
+    }
+
+    write(buffer);
+  }
+
+  void suite_finished(const SuiteSummary & /*summary*/) override { flush(); }
+
+private:
+  // The arguments of a test case, e.g. "increments(Point::origin)", aren't
+  // part of its fixture
+  static std::pair<std::string_view, std::string_view>
+  split_classname(std::string_view test) {
+    const size_t end = test.substr(0, test.find('(')).rfind("::");
+    if (end == std::string_view::npos) {
+      return {"testing", test};
+    }
+    return {test.substr(0, end), test.substr(end + 2)};
+  }
+
+  std::atomic<bool> finished{false};
+};
+
+// One JSON object per line, for tests as well as suites
+class JsonLinesReporter final : public StreamReporter {
+public:
+  explicit JsonLinesReporter(const std::string &path) : StreamReporter(path) {}
+
+  void test_finished(const TestResult &result) override {
+    auto &buffer = block_buffer();
+    append(buffer, "{\"event\":\"test\",\"name\":\"");
+    append_json_escaped(buffer, result.name);
+    fmt::format_to(std::back_inserter(buffer),
+                   "\",\"passed\":{},\"duration_ns\":{},",
+                   result.passed, result.duration.count());
+    if (result.allocations) {
+      fmt::format_to(std::back_inserter(buffer),
+                     "\"allocations\":{},\"allocated_bytes\":{},",
+                     result.allocations->count, result.allocations->bytes);
+    }
+    if (result.counters) {
+      fmt::format_to(std::back_inserter(buffer),
+                     "\"cycles\":{},\"instructions\":{},\"cache_misses\":{},"
+                     "\"branch_misses\":{},",
+                     result.counters->cycles, result.counters->instructions,
+                     result.counters->cache_misses,
+                     result.counters->branch_misses);
+    }
+    append(buffer, "\"message\":\"");
+    append_json_escaped(buffer, result.message);
+    append(buffer, "\"}\n");
+
+    write(buffer);
+  }
+
+  void suite_finished(const SuiteSummary &summary) override {
+    auto &buffer = block_buffer();
+    fmt::format_to(std::back_inserter(buffer),
+                   "{{\"event\":\"suite\",\"total\":{},\"failed\":{},"
+                   "\"duration_ns\":{}}}\n",
+                   summary.total, summary.failed, summary.duration.count());
+    write(buffer);
+    flush();
+  }
+};
+
+// TAP version 13. Tests are numbered across all suites, and the plan is
+// written by finish(), when the number of tests is known.
+class TapReporter final : public StreamReporter {
+public:
+  explicit TapReporter(const std::string &path) : StreamReporter(path) {
+    auto &buffer = block_buffer();
+    append(buffer, "TAP version 13\n");
+    write(buffer);
+  }
+
+  TapReporter(const TapReporter &) = delete;
+  TapReporter(TapReporter &&) = delete;
+  TapReporter &operator=(const TapReporter &) = delete;
+  TapReporter &operator=(TapReporter &&) = delete;
+
+  ~TapReporter() override { finish(); }
+
+  void finish() override {
+    std::lock_guard lock{mutex};
+    if (not is_runner_process() || std::exchange(finished, true)) {
+      return;
+    }
+    fmt::memory_buffer buffer;
+    fmt::format_to(std::back_inserter(buffer), "1..{}\n", count);
+    write(buffer);
+    flush();
+  }
+
+  void test_finished(const TestResult &result) override {
+    auto &buffer = block_buffer();
+
+    // Numbers must appear in order, so they're taken and written together
+    std::lock_guard lock{mutex};
+    fmt::format_to(std::back_inserter(buffer), "{} {} - ",
+                   result.passed ? "ok" : "not ok", ++count);
+    for (char c : result.name) {
+      if (c == '#') {
+        buffer.push_back('\\');
+      }
+      buffer.push_back(c == '\n' ? ' ' : c);
+    }
+    buffer.push_back('\n');
+
+    if (not result.passed) {
+      append(buffer, "  ---\n  message: |\n");
+      std::string_view message = result.message;
+      while (not message.empty()) {
+        const auto end = std::min(message.find('\n'), message.size());
+        append(buffer, "    ");
+        append(buffer, message.substr(0, end));
+        buffer.push_back('\n');
+        message.remove_prefix(std::min(end + 1, message.size()));
+      }
+      append(buffer, "  ...\n");
+    }
+
+    write(buffer);
+  }
+
+  void suite_finished(const SuiteSummary &summary) override {
+    auto &buffer = block_buffer();
+    fmt::format_to(std::back_inserter(buffer), "# {} tests, {} failed\n",
+                   summary.total, summary.failed);
+    write(buffer);
+    flush();
+  }
+
+private:
+  std::mutex mutex{};
+  size_t count = 0;
+  bool finished = false;
+};
+
+inline std::unique_ptr<Reporter> make_reporter() {
+  const auto &path = options().report_file;
+  switch (options().report_format) {
+  case ReportFormat::junit:
+    return std::make_unique<JUnitReporter>(path);
+  case ReportFormat::json_lines:
+    return std::make_unique<JsonLinesReporter>(path);
+  case ReportFormat::tap:
+    return std::make_unique<TapReporter>(path);
+  case ReportFormat::console:
+  default:
+    break;
+  }
+  return nullptr;
+}
+
+inline std::unique_ptr<Reporter> &reporter();
+
+// Only in the runner, not by a forked worker that calls exit()
+inline void finish_reporter() {
+  if (const auto &instance = reporter(); instance && is_runner_process()) {
+    instance->finish();
+  }
+}
+
+// Created from the options when the first result comes in. It's finished at
+// exit, also by std::quick_exit, unless testing::finish() did so before.
+inline std::unique_ptr<Reporter> &reporter() {
+  static std::unique_ptr<Reporter> instance = make_reporter();
+  // Registered once it's constructed, so it runs before the destructor
+  static const bool registered = []() {
+    static_cast<void>(is_runner_process());
+    std::atexit(finish_reporter);
+    std::at_quick_exit(finish_reporter);
+    return true;
+  }();
+  static_cast<void>(registered);
+  return instance;
+}
+
+// The console output goes to stdout unless a report took its place
+inline bool console_enabled() {
+  return options().report_format == ReportFormat::console ||
+         not options().report_file.empty();
+}
+
+} // namespace detail
+
+// Replaces the reporter chosen by options().report_format, e.g. with one of
+// the program's own. The console output isn't affected.
+inline void set_reporter(std::unique_ptr<Reporter> reporter) {
+  detail::reporter() = std::move(reporter);
+}
+
+} // namespace testing
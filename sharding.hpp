@@ -0,0 +1,103 @@
+#pragma once
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <cstdlib>
+#include <fstream>
+#include <map>
+#include <string>
+#include <string_view>
+#include <utility>
+#include <vector>
+
+#include "options.hpp"
+
+namespace testing::detail {
+
+// FNV-1a. Unlike std::hash, it's the same on every platform and run.
+constexpr uint64_t fnv1a(std::string_view str) {
+  uint64_t hash = 14695981039346656037ULL;
+  for (char c : str) {
+    hash ^= static_cast<unsigned char>(c);
+    hash *= 1099511628211ULL;
+  }
+  return hash;
+}
+
+// Assignment of tests to shards from the durations of a previous run. Tests
+// are handed out longest first, each to the shard with the least total time
+// so far. Ties are broken by name and shard index, so every shard computes
+// the same plan.
+class ShardPlan {
+public:
+  ShardPlan(const std::string &timings_path, size_t shard_count) {
+    if (timings_path.empty() || shard_count <= 1) {
+      return;
+    }
+
+    // Same format as the result file: pass|fail, nanoseconds, name
+    std::map<std::string, uint64_t, std::less<>> durations;
+    std::ifstream file{timings_path};
+    std::string line;
+    while (std::getline(file, line)) {
+      const auto first_tab = line.find('\t');
+      const auto second_tab = line.find('\t', first_tab + 1);
+      if (first_tab == std::string::npos || second_tab == std::string::npos) {
+        continue;
+      }
+
+      // A name may be run by several suites, all of that work is one unit
+      durations[line.substr(second_tab + 1)] +=
+          std::strtoull(line.c_str() + first_tab + 1, nullptr, 10);
+    }
+
+    std::vector<std::pair<std::string_view, uint64_t>> longest_first(
+        durations.begin(), durations.end());
+    std::stable_sort(longest_first.begin(), longest_first.end(),
+                     [](const auto &lhs, const auto &rhs) {
+                       return lhs.second > rhs.second;
+                     });
+
+    std::vector<uint64_t> loads(shard_count, 0);
+    for (const auto &[name, duration] : longest_first) {
+      const auto lightest = static_cast<size_t>(
+          std::min_element(loads.begin(), loads.end()) - loads.begin());
+      loads[lightest] += duration;
+      shards.emplace(name, lightest);
+    }
+  }
+
+  // The shard of a test, or shard_count if it has no recorded duration
+  [[nodiscard]] size_t shard_of(std::string_view name,
+                                size_t shard_count) const {
+    auto it = shards.find(name);
+    return (it != shards.end()) ? it->second : shard_count;
+  }
+
+private:
+  std::map<std::string, size_t, std::less<>> shards{};
+};
+
+inline const ShardPlan &shard_plan() {
+  static const ShardPlan instance{options().timings_file,
+                                  options().shard_count};
+  return instance;
+}
+
+// Whether a test belongs to the shard of this process. Tests with a recorded
+// duration are placed by the plan, all others by their name hash.
+inline bool in_shard(std::string_view name) {
+  const auto &opts = options();
+  if (opts.shard_count <= 1) {
+    return true;
+  }
+
+  const size_t planned = shard_plan().shard_of(name, opts.shard_count);
+  const size_t shard = (planned < opts.shard_count)
+                           ? planned
+                           : fnv1a(name) % opts.shard_count;
+  return shard == opts.shard_index;
+}
+
+} // namespace testing::detail
@@ -0,0 +1,229 @@
+#pragma once
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdio>
+#include <cstring>
+#include <experimental/source_location>
+#include <filesystem>
+#include <fmt/format.h>
+#include <fstream>
+#include <iterator>
+#include <ranges>
+#include <string>
+#include <string_view>
+#include <system_error>
+#include <type_traits>
+
+#include "asserts.hpp"
+#include "mapped_file.hpp"
+#include "options.hpp"
+#include "output.hpp"
+#include "reporter.hpp"
+
+namespace testing {
+
+namespace detail {
+
+// Bytes compared by one memcmp, so a mismatch early in a large output is
+// found without comparing the rest
+inline constexpr size_t snapshot_chunk_size = size_t{64} * 1024;
+
+// Lines, or rows of 16 bytes for binary data, shown from the first mismatch
+inline constexpr size_t snapshot_context_rows = 3;
+
+// Longer lines are cut off in the diff
+inline constexpr size_t snapshot_max_line = 160;
+
+// Offset of the first byte that differs, the size of the shorter one if it's
+// a prefix of the other
+inline size_t first_difference(std::string_view lhs, std::string_view rhs) {
+  const size_t size = std::min(lhs.size(), rhs.size());
+  for (size_t start = 0; start < size; start += snapshot_chunk_size) {
+    const size_t count = std::min(snapshot_chunk_size, size - start);
+    if (std::memcmp(lhs.data() + start, rhs.data() + start, count) != 0) {
+      const auto chunk = lhs.substr(start, count);
+      const auto mismatch =
+          std::ranges::mismatch(chunk, rhs.substr(start, count));
+      return start + static_cast<size_t>(mismatch.in1 - chunk.begin());
+    }
+  }
+  return size;
+}
+
+// Whether the bytes around offset look like text, so the diff shows lines
+inline bool is_text_near(std::string_view data, size_t offset) {
+  const size_t start = offset - std::min(offset, snapshot_max_line);
+  const auto window = data.substr(std::min(start, data.size()),
+                                  2 * snapshot_max_line);
+  return std::ranges::all_of(window, [](char c) {
+    return c == '\n' || c == '\r' || c == '\t' ||
+           (static_cast<unsigned char>(c) >= 0x20 && c != 0x7f);
+  });
+}
+
+// The lines from the one containing offset, numbered from line
+inline void append_lines(fmt::memory_buffer &buffer, std::string_view data,
+                         size_t offset, size_t line) {
+  const auto newline = offset == 0 ? std::string_view::npos
+                                    : data.rfind('\n', offset - 1);
+  auto rest = data.substr(newline == std::string_view::npos ? 0 : newline + 1);
+
+  for (size_t row = 0; row < snapshot_context_rows && not rest.empty();
+       ++row) {
+    const auto end = std::min(rest.find('\n'), rest.size());
+    const auto text = rest.substr(0, std::min(end, snapshot_max_line));
+    fmt::format_to(std::back_inserter(buffer), "\n  {:>6}| {}{}", line + row,
+                   text, end > snapshot_max_line ? "..." : "");
+    rest.remove_prefix(std::min(end + 1, rest.size()));
+  }
+}
+
+// Hex dump of the rows from the one containing offset
+inline void append_rows(fmt::memory_buffer &buffer, std::string_view data,
+                        size_t offset) {
+  constexpr size_t row_size = 16;
+  const size_t first = offset - offset % row_size;
+  const size_t end = std::min(first + snapshot_context_rows * row_size,
+                              data.size());
+  for (size_t row = first; row < end; row += row_size) {
+    fmt::format_to(std::back_inserter(buffer), "\n  {:08x}|", row);
+    for (size_t i = row; i < std::min(row + row_size, end); ++i) {
+      fmt::format_to(std::back_inserter(buffer), " {:02x}",
+                     static_cast<unsigned char>(data[i]));
+    }
+  }
+}
+
+inline void append_excerpt(fmt::memory_buffer &buffer, std::string_view title,
+                           std::string_view data, size_t offset, bool text,
+                           size_t line) {
+  fmt::format_to(std::back_inserter(buffer), "\n{} ({} bytes):", title,
+                 data.size());
+  if (offset >= data.size()) {
+    fmt::format_to(std::back_inserter(buffer), "\n  <end>");
+  } else if (text) {
+    append_lines(buffer, data, offset, line);
+  } else {
+    append_rows(buffer, data, offset);
+  }
+}
+
+TESTING_FAIL_NORETURN inline void
+fail_snapshot(std::experimental::source_location location,
+              const std::string &path, std::string_view snapshot,
+              std::string_view output, size_t offset) {
+  const bool text = is_text_near(snapshot, offset) &&
+                    is_text_near(output, offset);
+
+  auto &buffer = message_buffer();
+  fmt::format_to(std::back_inserter(buffer),
+                 "ASSERT: Output differs from snapshot '{}' at byte {}", path,
+                 offset);
+  size_t line = 1;
+  if (text) {
+    const auto before = snapshot.substr(0, offset);
+    line += static_cast<size_t>(std::ranges::count(before, '\n'));
+    fmt::format_to(std::back_inserter(buffer), ", line {}", line);
+  }
+  append_excerpt(buffer, "Snapshot", snapshot, offset, text, line);
+  append_excerpt(buffer, "Output", output, offset, text, line);
+  fmt::format_to(std::back_inserter(buffer),
+                 "\nRun with --update-snapshots to accept the output");
+  fail(location, {buffer.data(), buffer.size()});
+}
+
+// Replaces the snapshot through a temporary file, so a reader never sees a
+// partly written one
+inline bool write_snapshot(const std::string &path, std::string_view output) {
+  std::error_code error;
+  const std::filesystem::path file{path};
+  if (file.has_parent_path()) {
+    std::filesystem::create_directories(file.parent_path(), error);
+  }
+
+  const std::string temporary = path + ".tmp";
+  {
+    std::ofstream out{temporary, std::ios::binary | std::ios::trunc};
+    out.write(output.data(), static_cast<std::streamsize>(output.size()));
+    if (not out) {
+      return false;
+    }
+  }
+  std::filesystem::rename(temporary, file, error);
+  return not error;
+}
+
+} // namespace detail
+
+// Compares output to the file name in options().snapshot_dir (--snapshot-dir).
+// The file is memory-mapped and compared in chunks, so even outputs of
+// several GB cost no extra memory, and only a mismatch is rendered: the
+// lines, or a hex dump for binary data, from the first differing byte. With
+// options().update_snapshots (--update-snapshots), a missing or different
+// snapshot is replaced with the output instead of failing.
+inline void
+assert_matches_snapshot(std::string_view name, std::string_view output,
+                        const std::experimental::source_location location =
+                            std::experimental::source_location::current()) {
+  detail::note_assert(location);
+  const std::string path = options().snapshot_dir + "/" + std::string{name};
+
+  std::error_code error;
+  if (not std::filesystem::exists(path, error)) {
+    if (not options().update_snapshots) {
+      detail::fail_with(location,
+                        "ASSERT: Snapshot '{}' doesn't exist. Run with "
+                        "--update-snapshots to create it",
+                        path);
+      return;
+    }
+  } else {
+    const MappedFile snapshot{path};
+    if (not snapshot.is_open()) {
+      detail::fail_with(location, "ASSERT: Could not read snapshot '{}'",
+                        path);
+      return;
+    }
+    const auto contents = snapshot.contents();
+    const size_t offset = detail::first_difference(contents, output);
+    if (offset == contents.size() && offset == output.size()) {
+      return;
+    }
+    if (not options().update_snapshots) {
+      detail::fail_snapshot(location, path, contents, output, offset);
+      return;
+    }
+  }
+
+  if (not detail::write_snapshot(path, output)) {
+    detail::fail_with(location, "ASSERT: Could not write snapshot '{}'",
+                      path);
+    return;
+  }
+  if (not options().quiet && detail::console_enabled()) {
+    auto &buffer = detail::block_buffer();
+    fmt::format_to(std::back_inserter(buffer), "Updated snapshot '{}'\n",
+                   path);
+    detail::output().write({buffer.data(), buffer.size()});
+  }
+}
+
+// Same for the bytes of a contiguous range, e.g. a std::vector<std::byte> or
+// the records a serializer wrote
+template <std::ranges::contiguous_range Bytes>
+requires std::ranges::sized_range<Bytes> &&
+    std::is_trivially_copyable_v<std::ranges::range_value_t<Bytes>> &&
+    (not std::is_convertible_v<const Bytes &, std::string_view>)
+void assert_matches_snapshot(
+    std::string_view name, const Bytes &output,
+    const std::experimental::source_location location =
+        std::experimental::source_location::current()) {
+  const auto size =
+      std::ranges::size(output) * sizeof(std::ranges::range_value_t<Bytes>);
+  // NOLINTNEXTLINE: Compared as their object representation
+  const auto *data = reinterpret_cast<const char *>(std::ranges::data(output));
+  assert_matches_snapshot(name, std::string_view{data, size}, location);
+}
+
+} // namespace testing
@@ -0,0 +1,168 @@
+#pragma once
+
+#include <algorithm>
+#include <barrier>
+#include <chrono>
+#include <concepts>
+#include <cstddef>
+#include <fmt/format.h>
+#include <functional>
+#include <iterator>
+#include <string_view>
+#include <thread>
+#include <vector>
+
+#include "config.hpp"
+#include "property.hpp"
+#include "test.hpp"
+
+#ifdef TESTING_HAS_THREAD_AFFINITY
+#include <pthread.h>
+#include <sched.h>
+#endif
+
+namespace testing {
+
+struct StressConfig {
+  // Every iteration first yields with a chance of 1 in this, to shake up the
+  // interleavings. 0 never yields.
+  size_t yield_one_in = 0;
+  // Pin every thread to its own CPU, as far as there are enough
+  bool pin_threads = false;
+};
+
+namespace detail {
+
+// Pins the calling thread to the index-th CPU it may run on, modulo their
+// number. It's best effort, so a failure leaves the thread unpinned.
+inline void pin_to_cpu(size_t index) {
+#ifdef TESTING_HAS_THREAD_AFFINITY
+  cpu_set_t allowed;
+  CPU_ZERO(&allowed);
+  if (::sched_getaffinity(0, sizeof(allowed), &allowed) != 0) {
+    return;
+  }
+
+  const auto count = static_cast<size_t>(CPU_COUNT(&allowed));
+  size_t skip = index % std::max<size_t>(count, 1);
+  for (size_t cpu = 0; cpu < CPU_SETSIZE; ++cpu) {
+    if (CPU_ISSET(cpu, &allowed) && skip-- == 0) {
+      cpu_set_t pinned;
+      CPU_ZERO(&pinned);
+      CPU_SET(cpu, &pinned);
+      ::pthread_setaffinity_np(::pthread_self(), sizeof(pinned), &pinned);
+      return;
+    }
+  }
+#else
+  static_cast<void>(index);
+#endif
+}
+
+// Tests of a stress run either take the thread's index or nothing
+template <typename Fn> void invoke_stressed(Fn &fn, size_t thread) {
+  if constexpr (std::invocable<Fn &, size_t>) {
+    std::invoke(fn, thread);
+  } else {
+    std::invoke(fn);
+  }
+}
+
+// One message for all failed threads, in thread order
+inline std::string_view stress_message(const std::vector<TestResult> &results) {
+  fmt::memory_buffer buffer;
+  for (size_t thread = 0; thread < results.size(); ++thread) {
+    if (not results[thread].passed) {
+      fmt::format_to(std::back_inserter(buffer), "Thread {}:\n{}", thread,
+                     results[thread].message);
+    }
+  }
+  return message_arena().store({buffer.data(), buffer.size()});
+}
+
+} // namespace detail
+
+// Runs fn iterations times on each of threads threads at once. They're
+// released together by a barrier once they are all started, and pinned
+// first if the config asks for it. A thread stops at its first failure. The
+// run is reported as one test named fn_name, which fails if any thread did,
+// with the messages of the failed threads in thread order. Pairs well with
+// BP_USE_TSAN.
+template <detail::testsuite Suite, typename Fn>
+requires(std::invocable<Fn &> || std::invocable<Fn &, size_t>) bool stress(
+    Suite &test_suite, std::string_view fn_name, Fn &&fn, size_t threads,
+    size_t iterations, StressConfig config = {}) {
+  if (not detail::selected(fn_name)) {
+    return true;
+  }
+
+  const auto seed = detail::property_seed();
+  const auto start_time = std::chrono::steady_clock::now();
+  std::barrier start{static_cast<std::ptrdiff_t>(threads)};
+  std::vector<TestResult> results(threads);
+
+  auto run = [&](size_t thread) {
+    auto rng = detail::case_rng(seed, thread);
+    if (config.pin_threads) {
+      detail::pin_to_cpu(thread);
+    }
+
+    results[thread] = detail::run_test(fn_name, [&]() {
+      start.arrive_and_wait();
+      for (size_t i = 0; i < iterations; ++i) {
+        if (config.yield_one_in > 0 && rng.one_in(config.yield_one_in)) {
+          std::this_thread::yield();
+        }
+        detail::invoke_stressed(fn, thread);
+#ifdef TESTING_NO_EXCEPTIONS
+        if (detail::failure_state().failed) {
+          break;
+        }
+#endif
+      }
+    });
+  };
+
+  std::vector<std::thread> workers;
+  workers.reserve(threads);
+  for (size_t thread = 0; thread < threads; ++thread) {
+    workers.emplace_back(run, thread);
+  }
+  for (auto &worker : workers) {
+    worker.join();
+  }
+
+  TestResult result{fn_name, std::ranges::all_of(results, &TestResult::passed)};
+  if (not result.passed) {
+    result.message = detail::stress_message(results);
+  }
+  result.duration = std::chrono::steady_clock::now() - start_time;
+  detail::record_result(test_suite, result);
+
+  return result.passed;
+}
+
+} // namespace testing
+
+// Stress-tests fn, see testing::stress. An optional config follows the
+// iterations, e.g. STRESS(push_pop, 8, 10000, .yield_one_in = 16).
+#define STRESS(fn, threads, iterations, ...)                                   \
+  [&]() {                                                                      \
+    testing::TestSuite lambda_internal_suite;                                  \
+    auto lambda_internal_fail_c = static_cast<int>(                            \
+        not testing::stress(lambda_internal_suite, #fn, fn, threads,           \
+                            iterations, testing::StressConfig{__VA_ARGS__}));  \
+    lambda_internal_suite.report();                                            \
+    return testing::TestInfo{std::move(lambda_internal_suite),                 \
+                             lambda_internal_fail_c};                          \
+  }()
+
+#define STRESS_SUITE(suite, fn, threads, iterations, ...)                      \
+  [&]() {                                                                      \
+    auto lambda_internal_fail_c = static_cast<int>(                            \
+        not testing::stress(suite, #fn, fn, threads, iterations,               \
+                            testing::StressConfig{__VA_ARGS__}));              \
+    suite.report();                                                            \
+    return testing::TestInfo<decltype(suite) &>{suite,                         \
+                                                lambda_internal_fail_c};       \
+  }()
@@ -1,14 +1,48 @@
 #pragma once
 
+#include <algorithm>
+#include <array>
+#include <atomic>
 #include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <deque>
 #include <experimental/source_location>
+#include <functional>
 #include <fmt/core.h>
+#include <fmt/format.h>
+#include <future>
+#include <iterator>
+#include <mutex>
+#include <numeric>
+#include <optional>
+#include <set>
 #include <stdexcept>
 #include <string>
+#include <thread>
+#include <type_traits>
+#include <utility>
 #include <vector>
 
+#include "allocations.hpp"
+#include "append_log.hpp"
 #include "asserts.hpp"
 #include "concepts.hpp"
+#include "config.hpp"
+#include "dependencies.hpp"
+#include "failed_first.hpp"
+#include "filter.hpp"
+#include "isolation.hpp"
+#include "options.hpp"
+#include "output.hpp"
+#include "perf.hpp"
+#include "registry.hpp"
+#include "reporter.hpp"
+#include "sharding.hpp"
+#include "thread_pool.hpp"
+#include "timeout.hpp"
 #include "verify.hpp"
 
 namespace testing {
@@ -21,7 +55,10 @@ constexpr void print(const std::string_view fmt_str, Args &&...args) {
     // TODO: comptime checking doesn't work here, because I'm not in
     // a constexpr context. But fmt_str is logically still comptime,
     // so I need to take only literals somehow
-    fmt::vprint(fmt_str, fmt::make_args_checked<Args...>(fmt_str, args...));
+    auto &buffer = block_buffer();
+    fmt::vformat_to(std::back_inserter(buffer), fmt_str,
+                    fmt::make_args_checked<Args...>(fmt_str, args...));
+    output().write({buffer.data(), buffer.size()});
   }
 
   // TODO: Do something sensible for test reporting at compile-time
@@ -30,10 +67,18 @@ constexpr void print(const std::string_view fmt_str, Args &&...args) {
 constexpr void ensure(bool condition, std::string_view message = "",
                       const std::experimental::source_location loc =
                           std::experimental::source_location::current()) {
+  detail::note_assert(loc);
   if (not condition) {
-    throw std::invalid_argument(fmt::format(
-        "{}:{}:{} in {}(): Verfiy failed. Message: '{}'\n", loc.file_name(),
-        loc.line(), loc.column(), loc.function_name(), message));
+    auto what =
+        fmt::format("{}:{}:{} in {}(): Verfiy failed. Message: '{}'\n",
+                    loc.file_name(), loc.line(), loc.column(),
+                    loc.function_name(), message);
+#ifdef __cpp_exceptions
+    throw std::invalid_argument(what);
+#else
+    std::fputs(what.c_str(), stderr);
+    std::abort();
+#endif
   }
 }
 
@@ -59,24 +104,6 @@ constexpr const char *strchr(const char *str, int i) {
   return (*str == c) ? str : nullptr;
 }
 
-struct ConstexprTestSuite {
-  constexpr ConstexprTestSuite() = default;
-
-  constexpr void add_failed_test(std::string_view) const {
-    // TODO: Do something sensible
-  }
-
-  [[nodiscard]] constexpr int status() const { return 0; } // NOLINT
-
-  constexpr void increment_total() const { // TODO: Something sensible
-  }
-  constexpr void increment_failed() const { // TODO: Something sensible
-  }
-
-  void report() const { // TODO Something sensible
-  }
-};
-
 constexpr bool isspace(char c) {
   return c == ' ' || c == '\t' || c == '\n' || c == '\r';
 }
@@ -93,29 +120,415 @@ constexpr const char *skip_whitespace_and_ampersand(const char *str) {
   return str;
 }
 
+// Splits the stringified test list of the TEST_ALL macros into the N names
+template <size_t N>
+constexpr std::array<std::string_view, N> split_names(const char *fn_names) {
+  std::array<std::string_view, N> names{};
+
+  for (size_t i = 0; i < N; ++i) {
+    fn_names = skip_whitespace_and_ampersand(fn_names);
+
+    const char *pcomma = (i + 1 < N) ? strchr(fn_names, ',') : nullptr;
+    size_t len = (pcomma != nullptr) ? static_cast<size_t>(pcomma - fn_names)
+                                     : strlen(fn_names);
+
+    names[i] = std::string_view{fn_names, len};
+    fn_names = (pcomma != nullptr) ? pcomma + 1 : fn_names + len;
+  }
+
+  return names;
+}
+
+template <resettable_fixture Klass> Klass &reused_fixture() {
+  thread_local std::optional<Klass> instance;
+  if (instance) {
+    instance->reset();
+  } else {
+    instance.emplace();
+  }
+  return *instance;
+}
+
+// Runs a fixture method on a fixture. Resettable fixtures are reused by all
+// tests that run on the same thread, other fixtures are constructed for every
+// test.
+template <testfixture Klass, typename Method>
+requires fixture_testcase<Klass, Method> constexpr void
+invoke_with_fixture(Method &&method) {
+  if constexpr (resettable_fixture<Klass>) {
+    if (not std::is_constant_evaluated()) {
+      std::invoke(std::forward<Method>(method), &reused_fixture<Klass>());
+      return;
+    }
+  }
+
+  Klass fixture;
+  std::invoke(std::forward<Method>(method), &fixture);
+}
+
+// Calls the static setup() of a shared fixture on construction and its
+// teardown() on destruction. Does nothing for other types.
+template <typename Klass> class FixtureScope {
+public:
+  constexpr FixtureScope() {
+    if constexpr (shared_fixture<Klass>) {
+      if (not std::is_constant_evaluated()) {
+        Klass::setup();
+      }
+    }
+  }
+
+  FixtureScope(const FixtureScope &) = delete;
+  FixtureScope(FixtureScope &&) = delete;
+  FixtureScope &operator=(const FixtureScope &) = delete;
+  FixtureScope &operator=(FixtureScope &&) = delete;
+
+  constexpr ~FixtureScope() {
+    if constexpr (shared_fixture<Klass>) {
+      if (not std::is_constant_evaluated()) {
+        Klass::teardown();
+      }
+    }
+  }
+};
+
+// The fixture of a test list, or void if it has none
+template <typename Tests> struct list_fixture { using type = void; };
+
+template <typename Tests>
+requires requires() { typename Tests::fixture_type; }
+struct list_fixture<Tests> {
+  using type = typename Tests::fixture_type;
+};
+
+template <typename Tests>
+using list_fixture_t = typename list_fixture<Tests>::type;
+
 constexpr const char *FAILED = "\033[0;31mFAILED\33[0m";
 constexpr const char *PASSED = "\033[0;32mPASSED\33[0m";
 
 } // namespace detail
 
+// One test of a TestTable
+struct TestEntry {
+  std::string_view name{};
+  void (*fn)() = nullptr;
+};
+
+// The tests of one TEST_ALL list. They are called through a table of
+// function pointers, so running the list is a loop instead of one recursive
+// instantiation per test.
+template <size_t N> struct TestTable {
+  [[nodiscard]] static constexpr size_t size() { return N; }
+
+  [[nodiscard]] constexpr std::string_view name(size_t i) const {
+    return entries[i].name;
+  }
+
+  constexpr void invoke(size_t i) const { entries[i].fn(); }
+
+  std::array<TestEntry, N> entries{};
+};
+
+// One test of a FixtureTable. Exactly one of the method pointers is set.
+template <detail::testfixture Klass> struct FixtureEntry {
+  std::string_view name{};
+  void (Klass::*method)() = nullptr;
+  void (Klass::*const_method)() const = nullptr;
+};
+
+// Same as TestTable, but every test is a method that runs on a fixture, see
+// detail::invoke_with_fixture
+template <detail::testfixture Klass, size_t N> struct FixtureTable {
+  using fixture_type = Klass;
+
+  [[nodiscard]] static constexpr size_t size() { return N; }
+
+  [[nodiscard]] constexpr std::string_view name(size_t i) const {
+    return entries[i].name;
+  }
+
+  constexpr void invoke(size_t i) const {
+    if (entries[i].method != nullptr) {
+      detail::invoke_with_fixture<Klass>(entries[i].method);
+    } else {
+      detail::invoke_with_fixture<Klass>(entries[i].const_method);
+    }
+  }
+
+  std::array<FixtureEntry<Klass>, N> entries{};
+};
+
+namespace detail {
+
+// Builds the table for the TEST_ALL macros, so the names are split while
+// compiling. Tests are functions or lambdas without captures.
+template <typename... Fns>
+requires(std::convertible_to<Fns, void (*)()> &&...) consteval TestTable<
+    sizeof...(Fns)> make_table(const char *fn_names, Fns... fns) {
+  const auto names = split_names<sizeof...(Fns)>(fn_names);
+
+  size_t i = 0;
+  return TestTable<sizeof...(Fns)>{{{TestEntry{names[i++], fns}...}}};
+}
+
+template <testfixture Klass>
+constexpr FixtureEntry<Klass> fixture_entry(std::string_view name,
+                                            void (Klass::*method)()) {
+  return {name, method, nullptr};
+}
+
+template <testfixture Klass>
+constexpr FixtureEntry<Klass> fixture_entry(std::string_view name,
+                                            void (Klass::*method)() const) {
+  return {name, nullptr, method};
+}
+
+template <testfixture Klass, typename... Methods>
+requires(fixture_testcase<Klass, Methods> &&...) consteval FixtureTable<
+    Klass, sizeof...(Methods)> make_fixture_table(const char *fn_names,
+                                                  Methods... methods) {
+  const auto names = split_names<sizeof...(Methods)>(fn_names);
+
+  size_t i = 0;
+  return FixtureTable<Klass, sizeof...(Methods)>{
+      {{fixture_entry<Klass>(names[i++], methods)...}}};
+}
+
+} // namespace detail
+
+// Time a single test took to run, and whether it passed
+struct TestDuration {
+  std::string_view name{};
+  std::chrono::nanoseconds duration{};
+  bool passed = true;
+};
+
+namespace detail {
+
+// Tests of the whole run that failed, for options().fail_fast
+inline std::atomic<size_t> &run_failures() {
+  static std::atomic<size_t> count{0};
+  return count;
+}
+
+// Whether the run reached options().fail_fast failures. No more tests start
+// after that.
+inline bool stopped_early() {
+  return options().fail_fast > 0 &&
+         run_failures().load(std::memory_order_relaxed) >= options().fail_fast;
+}
+
+// Whether the options select a test, see `selected`
+inline bool matches_options(std::string_view name) {
+  return not stopped_early() && name_filter().matches(name) &&
+         change_filter().affected_test(name) && in_shard(name);
+}
+
+// Dependency maps can only be recorded from tests running in this process
+inline bool isolating() {
+  return options().isolate && options().write_deps_file.empty();
+}
+
+// Whether a test is run with the current options. In list mode, selected
+// tests are printed instead and none is run.
+inline bool selected(std::string_view name) {
+  if (not matches_options(name)) {
+    return false;
+  }
+
+  if (options().list_tests) {
+    print("{}\n", name);
+    return false;
+  }
+  return true;
+}
+
+// Indices of the selected tests of a list, in list order, except that tests
+// which failed in the previous run come first. For lists with a name index,
+// only the names that can match the filters are checked. All tests are
+// selected in constant evaluation.
+template <test_list Tests>
+constexpr std::vector<size_t> selected_indices(const Tests &tests) {
+  std::vector<size_t> indices;
+  if (std::is_constant_evaluated()) {
+    indices.resize(tests.size());
+    std::iota(indices.begin(), indices.end(), size_t{0});
+    return indices;
+  }
+
+  bool indexed = false;
+  if constexpr (indexed_test_list<Tests>) {
+    if (const auto prefixes = name_filter().prefixes()) {
+      std::vector<size_t> candidates;
+      for (const auto prefix : *prefixes) {
+        const auto matches = tests.with_prefix(prefix);
+        candidates.insert(candidates.end(), matches.begin(), matches.end());
+      }
+      std::sort(candidates.begin(), candidates.end());
+      candidates.erase(std::unique(candidates.begin(), candidates.end()),
+                       candidates.end());
+
+      for (const size_t i : candidates) {
+        if (matches_options(tests.name(i))) {
+          indices.push_back(i);
+        }
+      }
+      indexed = true;
+    }
+  }
+
+  for (size_t i = 0; not indexed && i < tests.size(); ++i) {
+    if (matches_options(tests.name(i))) {
+      indices.push_back(i);
+    }
+  }
+
+  failed_first().reorder(indices, [&tests](size_t i) { return tests.name(i); });
+
+  if (options().list_tests) {
+    for (const size_t i : indices) {
+      print("{}\n", tests.name(i));
+    }
+    indices.clear();
+  }
+  return indices;
+}
+
+// Appends one line per test to the result file: `pass` or `fail`, the
+// duration in nanoseconds and the name, separated by tabs. The first write of
+// a process to a file truncates it.
+inline void write_partial_result(const std::string &path,
+                                 const std::vector<TestDuration> &durations) {
+  if (path.empty()) {
+    return;
+  }
+
+  fmt::memory_buffer buffer;
+  for (const auto &[name, duration, passed] : durations) {
+    fmt::format_to(std::back_inserter(buffer), "{}\t{}\t",
+                   passed ? "pass" : "fail", duration.count());
+    for (char c : name) {
+      buffer.push_back((c == '\n' || c == '\t') ? ' ' : c);
+    }
+    buffer.push_back('\n');
+  }
+
+  static std::mutex mutex;
+  static std::set<std::string, std::less<>> truncated;
+  std::lock_guard lock{mutex};
+
+  const bool first = truncated.insert(path).second;
+  std::FILE *file = std::fopen(path.c_str(), first ? "w" : "a");
+  if (file == nullptr) {
+    std::fprintf(stderr, "Could not open result file '%s'\n", path.c_str());
+    return;
+  }
+  std::fwrite(buffer.data(), 1, buffer.size(), file);
+  std::fclose(file);
+}
+
+inline void print_slowest(std::vector<TestDuration> durations) {
+  const size_t count = std::min(options().slowest_count, durations.size());
+  if (count == 0) {
+    return;
+  }
+
+  std::chrono::nanoseconds sum{};
+  for (const auto &entry : durations) {
+    sum += entry.duration;
+  }
+
+  std::partial_sort(durations.begin(),
+                    durations.begin() + static_cast<std::ptrdiff_t>(count),
+                    durations.end(), [](const auto &lhs, const auto &rhs) {
+                      return lhs.duration > rhs.duration;
+                    });
+
+  print("SLOWEST:\n");
+  for (size_t i = 0; i < count; ++i) {
+    const auto &entry = durations[i];
+    const double share =
+        sum.count() > 0 ? 100.0 * static_cast<double>(entry.duration.count()) /
+                              static_cast<double>(sum.count())
+                        : 0.0;
+
+    print("{:>12.3f} ms {:>5.1f}%  {}\n",
+          std::chrono::duration<double, std::milli>(entry.duration).count(),
+          share, entry.name);
+  }
+}
+
+// The console gets a summary of the whole suite. Result files and reporters
+// only get the tests recorded since the suite was last reported, which are
+// all of them unless the suite is shared by several lists.
+inline void print_summary(const std::vector<std::string_view> &failed_testnames,
+                          std::vector<TestDuration> durations,
+                          const std::vector<TestDuration> &unreported,
+                          int total, int failed,
+                          std::chrono::steady_clock::time_point start) {
+  if (options().list_tests) {
+    output().flush();
+    return;
+  }
+
+  const auto elapsed = std::chrono::steady_clock::now() - start;
+
+  write_partial_result(options().result_file, unreported);
+  failed_first().record(unreported);
+  if (const auto &structured = reporter()) {
+    const auto new_failed = std::count_if(
+        unreported.begin(), unreported.end(),
+        [](const TestDuration &entry) { return not entry.passed; });
+    structured->suite_finished({static_cast<int>(unreported.size()),
+                                static_cast<int>(new_failed), elapsed});
+  }
+  if (not console_enabled()) {
+    return;
+  }
+
+  print("\n");
+  for (const auto &failed_testname : failed_testnames) {
+    print("{}: {}\n", FAILED, failed_testname);
+  }
+  print_slowest(std::move(durations));
+  if (stopped_early()) {
+    print("STOPPED: Reached {} failed tests, the remaining ones were skipped\n",
+          options().fail_fast);
+  }
+  print("SUMMARY: Ran {} tests in {:.3f} seconds. {} failed.\n\n", total,
+        seconds(elapsed), failed);
+
+  output().flush();
+}
+
+} // namespace detail
+
 struct TestSuite {
-  TestSuite() : start(std::chrono::system_clock::now()){};
+  TestSuite() : start(std::chrono::steady_clock::now()){};
 
   void add_failed_test(std::string_view sv) { failed_testnames.push_back(sv); }
 
+  void add_duration(std::string_view sv, std::chrono::nanoseconds duration,
+                    bool passed = true) {
+    durations.push_back({sv, duration, passed});
+  }
+
   [[nodiscard]] int status() const { return failed; }
 
-  void report() const {
-    auto end = std::chrono::system_clock::now();
-    auto elapsed =
-        std::chrono::duration_cast<std::chrono::seconds>(end - start);
+  void report() {
+    detail::print_summary(failed_testnames, durations, take_unreported(),
+                          total, failed, start);
+  }
 
-    detail::print("\n");
-    for (const auto &failed_testname : failed_testnames) {
-      detail::print("{}: {}\n", detail::FAILED, failed_testname);
-    }
-    detail::print("SUMMARY: Ran {} tests in {} seconds. {} failed.\n\n", total,
-                  elapsed.count(), failed);
+  // Durations recorded since the last call, which report() writes to the
+  // result file and the reporter
+  std::vector<TestDuration> take_unreported() {
+    std::vector<TestDuration> unreported(
+        durations.begin() + static_cast<std::ptrdiff_t>(reported),
+        durations.end());
+    reported = durations.size();
+    return unreported;
   }
 
   void increment_total() { total += 1; }
@@ -123,132 +536,770 @@ struct TestSuite {
 
   int total = 0;
   int failed = 0;
-  std::chrono::time_point<std::chrono::system_clock> start;
+  std::chrono::steady_clock::time_point start;
   std::vector<std::string_view> failed_testnames{};
+  std::vector<TestDuration> durations{};
+
+private:
+  // Durations that were already passed to an earlier report()
+  size_t reported = 0;
+};
+
+// Test suite that may be shared between threads, e.g. by calling
+// TEST_ALL_SUITE from several threads at once. Counters are atomic and every
+// thread records into its own append-only buffers, so running a test never
+// takes a lock. The buffers are merged in report().
+struct ConcurrentTestSuite {
+  ConcurrentTestSuite() : start(std::chrono::steady_clock::now()){};
+
+  ConcurrentTestSuite(const ConcurrentTestSuite &) = delete;
+  ConcurrentTestSuite(ConcurrentTestSuite &&) = delete;
+  ConcurrentTestSuite &operator=(const ConcurrentTestSuite &) = delete;
+  ConcurrentTestSuite &operator=(ConcurrentTestSuite &&) = delete;
+  ~ConcurrentTestSuite() = default;
+
+  void add_failed_test(std::string_view sv) {
+    local_buffer().failed_testnames.push_back(sv);
+  }
+
+  void add_duration(std::string_view sv, std::chrono::nanoseconds duration,
+                    bool passed = true) {
+    local_buffer().durations.push_back({sv, duration, passed});
+  }
+
+  [[nodiscard]] int status() const { return failed.load(); }
+
+  void report() {
+    detail::print_summary(failed_testnames(), durations(), take_unreported(),
+                          total.load(), failed.load(), start);
+  }
+
+  // Durations of all threads recorded since the last call, see TestSuite
+  std::vector<TestDuration> take_unreported() {
+    std::vector<TestDuration> unreported;
+    std::lock_guard lock{buffers_mutex};
+    for (auto &buffer : buffers) {
+      size_t index = 0;
+      buffer.durations.for_each([&](const TestDuration &entry) {
+        if (index++ >= buffer.reported) {
+          unreported.push_back(entry);
+        }
+      });
+      buffer.reported = index;
+    }
+
+    return unreported;
+  }
+
+  void increment_total() { total.fetch_add(1, std::memory_order_relaxed); }
+  void increment_failed() { failed.fetch_add(1, std::memory_order_relaxed); }
+
+  // Failures of all threads, grouped by the thread that recorded them
+  [[nodiscard]] std::vector<std::string_view> failed_testnames() const {
+    std::vector<std::string_view> merged;
+    for_each_buffer([&merged](const ThreadBuffer &buffer) {
+      buffer.failed_testnames.for_each(
+          [&merged](std::string_view name) { merged.push_back(name); });
+    });
+
+    return merged;
+  }
+
+  [[nodiscard]] std::vector<TestDuration> durations() const {
+    std::vector<TestDuration> merged;
+    for_each_buffer([&merged](const ThreadBuffer &buffer) {
+      buffer.durations.for_each(
+          [&merged](const TestDuration &entry) { merged.push_back(entry); });
+    });
+
+    return merged;
+  }
+
+  std::atomic<int> total{0};
+  std::atomic<int> failed{0};
+  std::chrono::steady_clock::time_point start;
+
+private:
+  struct ThreadBuffer {
+    explicit ThreadBuffer(std::thread::id _owner) : owner(_owner) {}
+
+    std::thread::id owner;
+    detail::AppendLog<std::string_view> failed_testnames{};
+    detail::AppendLog<TestDuration> durations{};
+    // Durations that were already passed to an earlier report()
+    size_t reported = 0;
+  };
+
+  template <typename Fn> void for_each_buffer(Fn &&fn) const {
+    std::lock_guard lock{buffers_mutex};
+    for (const auto &buffer : buffers) {
+      fn(buffer);
+    }
+  }
+
+  // Only a thread's first record in this suite searches the buffers. After
+  // that its buffer is found through the thread-local cache.
+  ThreadBuffer &local_buffer() {
+    thread_local struct {
+      uint64_t suite_id = 0;
+      ThreadBuffer *buffer = nullptr;
+    } cache;
+
+    if (cache.suite_id != id) {
+      const auto owner = std::this_thread::get_id();
+
+      std::lock_guard lock{buffers_mutex};
+      auto it =
+          std::find_if(buffers.begin(), buffers.end(),
+                       [&owner](const auto &b) { return b.owner == owner; });
+
+      cache.suite_id = id;
+      cache.buffer =
+          (it != buffers.end()) ? &*it : &buffers.emplace_back(owner);
+    }
+
+    return *cache.buffer;
+  }
+
+  inline static std::atomic<uint64_t> next_id{1};
+
+  uint64_t id = next_id.fetch_add(1);
+  mutable std::mutex buffers_mutex{};
+  std::deque<ThreadBuffer> buffers{};
 };
 
+// Ends the report and writes the failed-first file, which otherwise happens
+// at exit. Call it after the last suite was reported if the program may end
+// without exit handlers, e.g. through std::terminate or _exit. Results that
+// come in afterwards aren't part of the report.
+inline void finish() {
+  detail::finish_reporter();
+  detail::failed_first().write();
+}
+
+// Ends the program with status after finish(). If a test timed out on a
+// thread that was abandoned, that's by std::quick_exit, since the thread may
+// still use what static destructors would destroy.
+[[noreturn]] inline void finish_and_exit(int status) {
+  finish();
+  if (detail::abandoned_threads().load() == 0) {
+    std::exit(status);
+  }
+  detail::output().flush();
+  std::fflush(nullptr);
+  std::quick_exit(status);
+}
+
 template <detail::testsuite Suite> struct TestInfo {
   explicit TestInfo(Suite _suite, int fail_c)
-      : suite(std::move(_suite)), fail_count(fail_c) {}
+      : suite(std::forward<Suite>(_suite)), fail_count(fail_c) {}
 
   Suite suite;
   int fail_count{};
 };
 
-template <detail::testsuite Suite, detail::testcase Fn>
-constexpr bool test_single(Suite &test_suite, std::string_view fn_name,
-                           Fn &&fn) {
-  detail::print("Running {}...\n", fn_name);
+namespace detail {
+
+template <testcase Fn>
+constexpr TestResult run_test(std::string_view fn_name, Fn &&fn) {
+  TestResult result{fn_name};
 
-  bool passed = false;
+  std::chrono::steady_clock::time_point start{};
+  AllocationCounts allocations_start{};
+  std::optional<PerfCounts> counters_start{};
+  if (not std::is_constant_evaluated()) {
+    start_recording();
+    start = std::chrono::steady_clock::now();
+    allocations_start = allocation_counts();
+    if (measuring_perf_counters()) {
+      counters_start = perf_events().read();
+    }
+  }
+
+#ifdef TESTING_NO_EXCEPTIONS
+  if (not std::is_constant_evaluated()) {
+    failure_state().failed = false;
+  }
+#endif
+
+#ifdef __cpp_exceptions
   try {
     std::invoke(std::forward<Fn>(fn));
-    passed = true;
-  } catch (const detail::AssertFailure &e) {
-    passed = false;
-    fmt::print("{}", e.what());
+    result.passed = true;
+  } catch (const AssertFailure &e) {
+    result.passed = false;
+    result.message = e.message;
+  } catch (const std::exception &e) {
+    result.passed = false;
+    result.message = format_message(
+        "ERROR: Unexpected std::exception escaped the test. what(): '{}'\n",
+        e.what());
+  } catch (...) {
+    result.passed = false;
+    result.message = "ERROR: Unexpected unknown exception escaped the test\n";
   }
+#else
+  std::invoke(std::forward<Fn>(fn));
+  result.passed = true;
+#endif
 
-  detail::print("{}: {}\n\n", passed ? detail::PASSED : detail::FAILED,
-                fn_name);
+#ifdef TESTING_NO_EXCEPTIONS
+  // Asserts only recorded their failure, the test itself returned normally
+  if (not std::is_constant_evaluated() && failure_state().failed) {
+    result.passed = false;
+    result.message = failure_state().message;
+    failure_state().failed = false;
+  }
+#endif
+
+  if (not std::is_constant_evaluated()) {
+    if (counters_start) {
+      result.counters = perf_counts_since(*counters_start);
+    }
+    result.duration = std::chrono::steady_clock::now() - start;
+    if (allocation_tracker_installed()) {
+      result.allocations = allocations_since(allocations_start);
+    }
+    stop_recording(fn_name);
+  }
+
+  return result;
+}
+
+// Runs a test on this thread's Executor and stops waiting for it at the
+// deadline. A test that times out keeps running on the abandoned thread, so
+// the job holds a copy of fn unless it can't be copied. What fn refers to,
+// e.g. the fixture or test list of the runner, is used after the runner moved
+// on, since a thread can't be stopped safely. That's by design: a timeout
+// only promises a report, and anything that must survive a runaway test needs
+// --isolate, which kills its worker process instead.
+template <testcase Fn>
+TestResult
+run_test_on_executor(std::string_view fn_name, Fn &fn,
+                     std::chrono::steady_clock::time_point deadline) {
+  const auto start = std::chrono::steady_clock::now();
+  if (start >= deadline) {
+    return TestResult{fn_name, false, "ERROR: Not run, the suite timed out\n"};
+  }
+
+  auto result = std::make_shared<TestResult>();
+  const auto job = [&]() {
+    if constexpr (std::copy_constructible<Fn>) {
+      return [result, fn_name, fn]() { *result = run_test(fn_name, fn); };
+    } else {
+      return [result, fn_name, &fn]() { *result = run_test(fn_name, fn); };
+    }
+  }();
+  const bool finished = executor().run_until(job, deadline);
+  if (finished) {
+    return std::move(*result);
+  }
+
+  const auto elapsed = std::chrono::steady_clock::now() - start;
+  return TestResult{fn_name, false,
+                    message_arena().store(timeout_message(elapsed)), elapsed};
+}
+
+// Same as run_test, but with a time limit if there is a deadline
+template <testcase Fn>
+constexpr TestResult run_test_until(std::string_view fn_name, Fn &&fn,
+                                    std::chrono::steady_clock::time_point
+                                        deadline) {
+  if (std::is_constant_evaluated() || deadline == no_deadline) {
+    return run_test(fn_name, std::forward<Fn>(fn));
+  }
+  return run_test_on_executor(fn_name, fn, deadline);
+}
+
+// Test whose name was written before it ran, see announce_test
+inline std::string_view &announced_test() {
+  thread_local std::string_view name;
+  return name;
+}
+
+// Serial runs that show passing tests write the name of a test, and the batch
+// before it, before the test runs. So a crash or hang shows which test was
+// running, and the test's own output comes after its name. Quiet and parallel
+// runs only write whole results, in batches.
+inline void announce_test(std::string_view name) {
+  if (not console_enabled() || options().quiet) {
+    return;
+  }
+
+  auto &buffer = block_buffer();
+  fmt::format_to(std::back_inserter(buffer), "Running {}...\n", name);
+  output().write({buffer.data(), buffer.size()});
+  output().flush();
+  announced_test() = name;
+}
+
+// Writes the whole output of one test as a single block, without the name
+// if it was announced. In quiet mode, passing tests produce no output at all.
+inline void write_result(const TestResult &result) {
+  if (result.passed && options().quiet) {
+    return;
+  }
+
+  auto &buffer = block_buffer();
+  if (std::exchange(announced_test(), {}) != result.name) {
+    fmt::format_to(std::back_inserter(buffer), "Running {}...\n",
+                   result.name);
+  }
+  fmt::format_to(std::back_inserter(buffer), "{}{}: {}", result.message,
+                 result.passed ? PASSED : FAILED, result.name);
+  if (result.allocations) {
+    fmt::format_to(std::back_inserter(buffer), " ({} allocations, {} bytes)",
+                   result.allocations->count, result.allocations->bytes);
+  }
+  if (const auto &counters = result.counters) {
+    fmt::format_to(std::back_inserter(buffer),
+                   " ({} instructions, {} cycles, {} cache misses, {} branch "
+                   "misses)",
+                   counters->instructions, counters->cycles,
+                   counters->cache_misses, counters->branch_misses);
+  }
+  append(buffer, "\n\n");
+
+  output().write({buffer.data(), buffer.size()});
+}
+
+// Same as run_test_until for a test that runs serially, which is announced
+template <testcase Fn>
+constexpr TestResult
+run_serial_test(std::string_view fn_name, Fn &&fn,
+                std::chrono::steady_clock::time_point deadline) {
+  if (not std::is_constant_evaluated()) {
+    announce_test(fn_name);
+  }
+  return run_test_until(fn_name, std::forward<Fn>(fn), deadline);
+}
+
+// Passes a result to the console and the structured reporter
+inline void report_result(const TestResult &result) {
+  if (console_enabled()) {
+    write_result(result);
+  }
+  if (const auto &structured = reporter()) {
+    structured->test_finished(result);
+  }
+}
+
+template <testsuite Suite>
+constexpr void record_result(Suite &test_suite, const TestResult &result) {
+  if (not std::is_constant_evaluated()) {
+    report_result(result);
+  }
 
   test_suite.increment_total();
+  test_suite.add_duration(result.name, result.duration, result.passed);
 
-  if (not passed) {
+  if (not result.passed) {
     test_suite.increment_failed();
-    test_suite.add_failed_test(fn_name);
+    test_suite.add_failed_test(result.name);
+
+    if (not std::is_constant_evaluated()) {
+      run_failures().fetch_add(1, std::memory_order_relaxed);
+    }
   }
+}
 
-  return passed;
+// Results of the tests submitted to a pool. Tests that were skipped by
+// fail-fast when their turn came have none.
+using PendingResults = std::vector<std::future<std::optional<TestResult>>>;
+
+template <testsuite Suite>
+int record_results(Suite &test_suite, PendingResults &results) {
+  int fail_count = 0;
+  for (auto &future : results) {
+    const auto result = future.get();
+    if (not result) {
+      continue;
+    }
+    record_result(test_suite, *result);
+
+    fail_count += static_cast<int>(not result->passed);
+  }
+
+  return fail_count;
 }
 
-template <detail::testsuite Suite, detail::testcase Fn, detail::testcase... Fns>
-constexpr int test_all(Suite &test_suite, const char *fn_names, Fn &&fn,
-                       Fns &&...rest) {
-  fn_names = detail::skip_whitespace_and_ampersand(fn_names);
-  if constexpr (sizeof...(rest) > 0) {
-    const char *pcomma = detail::strchr(fn_names, ',');
-    std::string_view fn_name{fn_names, static_cast<size_t>(pcomma - fn_names)};
+// Submits a test to the pool. Its timeout starts when it does.
+template <testcase Fn>
+void submit_test(ThreadPool &pool, PendingResults &results,
+                 std::string_view name,
+                 std::chrono::steady_clock::time_point suite_end, Fn fn) {
+  results.push_back(pool.submit(
+      [name, suite_end, fn = std::move(fn)]() -> std::optional<TestResult> {
+        if (stopped_early()) {
+          return std::nullopt;
+        }
+        return run_test_until(name, fn, test_deadline(suite_end));
+      }));
+}
 
-    bool single_failed =
-        !test_single(test_suite, fn_name, std::forward<Fn>(fn));
-    auto rest_fails =
-        test_all(test_suite, pcomma + 1, std::forward<Fns>(rest)...);
+// Same, unless the test isn't selected to run
+template <testcase Fn>
+void submit_selected(ThreadPool &pool, PendingResults &results,
+                     std::string_view name,
+                     std::chrono::steady_clock::time_point suite_end, Fn fn) {
+  if (selected(name)) {
+    submit_test(pool, results, name, suite_end, std::move(fn));
+  }
+}
 
-    return static_cast<int>(single_failed) + rest_fails;
-  } else {
-    std::string_view fn_name{fn_names, detail::strlen(fn_names)};
+} // namespace detail
+
+// Tests that aren't selected by the options, like those of other shards, are
+// skipped and count as passed
+template <detail::testsuite Suite, detail::testcase Fn>
+constexpr bool test_single(Suite &test_suite, std::string_view fn_name,
+                           Fn &&fn) {
+  if (not std::is_constant_evaluated() && not detail::selected(fn_name)) {
+    return true;
+  }
+
+  auto result = detail::run_serial_test(fn_name, std::forward<Fn>(fn),
+                                        detail::test_deadline());
+  detail::record_result(test_suite, result);
+
+  return result.passed;
+}
 
-    return static_cast<int>(
-        !test_single(test_suite, fn_name, std::forward<Fn>(fn)));
+// Runs every test of a test list in forked worker processes, see
+// detail::ForkedPool. A test that crashes or exits the process fails, and the
+// others are unaffected. Results are reported in list order, each as soon as
+// it and the ones before it came back.
+template <detail::testsuite Suite, detail::test_list Tests>
+int run_tests_isolated(Suite &test_suite, const Tests &tests) {
+  const auto indices = detail::selected_indices(tests);
+
+  // Workers are forked after the setup, so they share the fixture's state
+  const detail::FixtureScope<detail::list_fixture_t<Tests>> fixture_scope;
+
+  detail::flush_before_fork();
+
+  const size_t workers = (options().isolation_workers > 0)
+                             ? options().isolation_workers
+                             : detail::default_parallelism();
+  auto run = [&tests, &indices](size_t job) {
+    const size_t i = indices[job];
+    return detail::run_test(tests.name(i), [&tests, i]() { tests.invoke(i); });
+  };
+  const size_t failures = detail::run_failures().load();
+  const detail::JobLimits limits{
+      options().test_timeout, detail::suite_deadline(),
+      options().fail_fast > failures ? options().fail_fast - failures : 0};
+  int fail_count = 0;
+  auto report = [&](size_t job, const detail::JobRecord &record) {
+    if (record.skipped) {
+      return;
+    }
+    const TestResult result{tests.name(indices[job]), record.passed,
+                            record.message, record.duration,
+                            record.allocations, record.counters};
+    detail::record_result(test_suite, result);
+
+    fail_count += static_cast<int>(not result.passed);
+  };
+  detail::run_forked(indices.size(), workers, limits, run, report);
+
+  return fail_count;
+}
+
+// Runs every test of a test list, in order. With options().isolate, they run
+// in worker processes instead.
+template <detail::testsuite Suite, detail::test_list Tests>
+constexpr int run_tests(Suite &test_suite, const Tests &tests) {
+  if (not std::is_constant_evaluated() && detail::isolating()) {
+    return run_tests_isolated(test_suite, tests);
+  }
+
+  const detail::FixtureScope<detail::list_fixture_t<Tests>> fixture_scope;
+  const auto suite_end = detail::suite_deadline();
+
+  int fail_count = 0;
+  for (const size_t i : detail::selected_indices(tests)) {
+    if (not std::is_constant_evaluated() && detail::stopped_early()) {
+      break;
+    }
+
+    const auto result = detail::run_serial_test(
+        tests.name(i), [&tests, i]() { tests.invoke(i); },
+        detail::test_deadline(suite_end));
+    detail::record_result(test_suite, result);
+
+    fail_count += static_cast<int>(not result.passed);
   }
+
+  return fail_count;
+}
+
+// Runs every test of a test list on a work-stealing thread pool. Results are
+// reported in list order as soon as they are available. The tests must not
+// depend on each other or on shared mutable state. Isolated runs are already
+// parallel.
+template <detail::testsuite Suite, detail::test_list Tests>
+int run_tests_parallel(Suite &test_suite, const Tests &tests) {
+  if (detail::isolating()) {
+    return run_tests_isolated(test_suite, tests);
+  }
+
+  // Declared before the pool, so the teardown waits for all tests
+  const detail::FixtureScope<detail::list_fixture_t<Tests>> fixture_scope;
+  detail::ThreadPool pool{
+      std::min<size_t>(tests.size(), detail::default_parallelism())};
+
+  const auto suite_end = detail::suite_deadline();
+
+  detail::PendingResults results;
+  results.reserve(tests.size());
+  for (const size_t i : detail::selected_indices(tests)) {
+    detail::submit_test(pool, results, tests.name(i), suite_end,
+                        [&tests, i]() { tests.invoke(i); });
+  }
+
+  return detail::record_results(test_suite, results);
+}
+
+template <detail::testsuite Suite, detail::testcase... Fns>
+constexpr int test_all(Suite &test_suite, const char *fn_names, Fns &&...fns) {
+  const auto names = detail::split_names<sizeof...(Fns)>(fn_names);
+
+  int fail_count = 0;
+  [&]<size_t... Is>(std::index_sequence<Is...>) {
+    ((fail_count += static_cast<int>(
+          not test_single(test_suite, names[Is], std::forward<Fns>(fns)))),
+     ...);
+  }
+  (std::index_sequence_for<Fns...>{});
+
+  return fail_count;
 }
 
 template <detail::testfixture Class, detail::testsuite Suite, typename Method>
 requires detail::fixture_testcase<Class, Method> constexpr bool
 test_single_with_fixture(Suite &test_suite, std::string_view fn_name,
                          Method &&fn) {
-  detail::print("Running {}...\n", fn_name);
+  if (not std::is_constant_evaluated() && not detail::selected(fn_name)) {
+    return true;
+  }
 
-  bool passed = false;
+  auto result = detail::run_serial_test(
+      fn_name,
+      [&fn]() {
+        detail::invoke_with_fixture<Class>(std::forward<Method>(fn));
+      },
+      detail::test_deadline());
+  detail::record_result(test_suite, result);
 
-  {
-    Class fixture;
+  return result.passed;
+}
 
-    try {
-      std::invoke(std::forward<Method>(fn), &fixture);
-      passed = true;
-    } catch (const detail::AssertFailure &e) {
-      passed = false;
-      fmt::print("{}", e.what());
-    }
+template <detail::testfixture Klass, detail::testsuite Suite,
+          typename... Methods>
+requires(detail::fixture_testcase<Klass, Methods> &&...) constexpr int
+test_all_with_fixture(Suite &test_suite, const char *fn_names,
+                      Methods &&...methods) {
+  const detail::FixtureScope<Klass> fixture_scope;
+  const auto names = detail::split_names<sizeof...(Methods)>(fn_names);
+
+  int fail_count = 0;
+  [&]<size_t... Is>(std::index_sequence<Is...>) {
+    ((fail_count += static_cast<int>(not test_single_with_fixture<Klass>(
+          test_suite, names[Is], std::forward<Methods>(methods)))),
+     ...);
   }
+  (std::index_sequence_for<Methods...>{});
 
-  detail::print("{}: {}\n\n", passed ? detail::PASSED : detail::FAILED,
-                fn_name);
+  return fail_count;
+}
 
-  test_suite.increment_total();
+// Same as test_all, but the tests run concurrently on a work-stealing thread
+// pool. They must not depend on each other or on shared mutable state.
+template <detail::testsuite Suite, detail::testcase... Fns>
+int test_all_parallel(Suite &test_suite, const char *fn_names, Fns &&...fns) {
+  const auto names = detail::split_names<sizeof...(Fns)>(fn_names);
+  detail::ThreadPool pool{
+      std::min(sizeof...(Fns), detail::default_parallelism())};
 
-  if (not passed) {
-    test_suite.increment_failed();
-    test_suite.add_failed_test(fn_name);
+  const auto suite_end = detail::suite_deadline();
+
+  detail::PendingResults results;
+  results.reserve(sizeof...(Fns));
+  [&]<size_t... Is>(std::index_sequence<Is...>) {
+    (detail::submit_selected(pool, results, names[Is], suite_end,
+                             [&fn = fns]() { std::invoke(fn); }),
+     ...);
   }
+  (std::index_sequence_for<Fns...>{});
 
-  return passed;
+  return detail::record_results(test_suite, results);
 }
 
-template <detail::testfixture Klass, detail::testsuite Suite, typename Method,
+template <detail::testfixture Klass, detail::testsuite Suite,
           typename... Methods>
-    requires detail::fixture_testcase<Klass, Method> &&
-    (detail::fixture_testcase<Klass, Methods> &&
-     ...) constexpr int test_all_with_fixture(Suite &test_suite,
-                                              const char *fn_names, Method &&fn,
-                                              Methods &&...rest) {
-  fn_names = detail::skip_whitespace_and_ampersand(fn_names);
-  if constexpr (sizeof...(rest) > 0) {
-    const char *pcomma = detail::strchr(fn_names, ',');
-    std::string_view fn_name{fn_names, static_cast<size_t>(pcomma - fn_names)};
-
-    bool single_failed = !test_single_with_fixture<Klass>(
-        test_suite, fn_name, std::forward<Method>(fn));
-
-    auto rest_fails = test_all_with_fixture<Klass>(
-        test_suite, pcomma + 1, std::forward<Methods>(rest)...);
-
-    return rest_fails + static_cast<int>(single_failed);
+requires(detail::fixture_testcase<Klass, Methods> &&...) int
+test_all_with_fixture_parallel(Suite &test_suite, const char *fn_names,
+                               Methods &&...methods) {
+  const auto names = detail::split_names<sizeof...(Methods)>(fn_names);
+  const detail::FixtureScope<Klass> fixture_scope;
+  detail::ThreadPool pool{
+      std::min(sizeof...(Methods), detail::default_parallelism())};
+
+  const auto suite_end = detail::suite_deadline();
+
+  detail::PendingResults results;
+  results.reserve(sizeof...(Methods));
+  [&]<size_t... Is>(std::index_sequence<Is...>) {
+    (detail::submit_selected(pool, results, names[Is], suite_end,
+                             [&method = methods]() {
+                               detail::invoke_with_fixture<Klass>(method);
+                             }),
+     ...);
+  }
+  (std::index_sequence_for<Methods...>{});
+
+  return detail::record_results(test_suite, results);
+}
+
+namespace detail {
+
+// Name of a test as a template argument, so compile errors can show it
+template <size_t N> struct FixedString {
+  constexpr explicit FixedString(std::string_view str) {
+    std::copy_n(str.begin(), N - 1, data);
+  }
+
+  char data[N]{};
+};
+
+#ifdef TESTING_CONSTEXPR_ONLY
+#define TESTING_STRINGIFY_IMPL(x) #x
+#define TESTING_STRINGIFY(x) TESTING_STRINGIFY_IMPL(x)
+inline constexpr std::string_view measured_test_name =
+    TESTING_STRINGIFY(TESTING_CONSTEXPR_ONLY);
+#undef TESTING_STRINGIFY
+#undef TESTING_STRINGIFY_IMPL
+#endif
+
+// Name of the only constexpr test to evaluate, set by
+// cmake/constexpr_budget.py to measure one test per compilation. The others
+// count as passed without being evaluated, so such a build is only good for
+// measuring.
+constexpr bool measured_test(std::string_view name) {
+#ifdef TESTING_CONSTEXPR_ONLY
+  return name == measured_test_name;
+#else
+  static_cast<void>(name);
+  return true;
+#endif
+}
+
+template <const auto &Tests, size_t I> constexpr bool probe_test() {
+  if constexpr (measured_test(Tests.name(I))) {
+#ifdef TESTING_CONSTEXPR_ONLY
+    // Past the step limit a TEST_ALL_AUTO probe would only come out false,
+    // and the measuring compilation would still pass
+    static_assert(constant_test<Tests, I>,
+                  "The measured test isn't constant evaluated");
+#endif
+    return constant_test<Tests, I>;
   } else {
-    std::string_view fn_name{fn_names, detail::strlen(fn_names)};
+    return true;
+  }
+}
+
+// Fails compilation for a failed test, unless TESTING_CONSTEXPR_SOFT_FAIL
+// leaves it to the runtime report. Every failed test gets its own error.
+template <FixedString name, bool passed> constexpr bool constexpr_outcome() {
+#ifndef TESTING_CONSTEXPR_SOFT_FAIL
+  static_assert(passed, "Test failed at compile time, or isn't constexpr. "
+                        "Its name is in the template arguments");
+#endif
+  return passed;
+}
+
+// Outcome of every test of a table, evaluated while compiling. Each test is
+// probed on its own, so a failure doesn't stop the evaluation of the others.
+template <const auto &Tests> constexpr auto evaluate_constexpr() {
+  return []<size_t... Is>(std::index_sequence<Is...>) {
+    return std::array<bool, sizeof...(Is)>{
+        {constexpr_outcome<FixedString<Tests.name(Is).size() + 1>{
+                               Tests.name(Is)},
+                           probe_test<Tests, Is>()>()...}};
+  }
+  (std::make_index_sequence<Tests.size()>{});
+}
+
+// Which tests of a table can be constant evaluated, without failing the
+// compilation for the others
+template <const auto &Tests> constexpr auto probe_constexpr() {
+  return []<size_t... Is>(std::index_sequence<Is...>) {
+    return std::array<bool, sizeof...(Is)>{{probe_test<Tests, Is>()...}};
+  }
+  (std::make_index_sequence<Tests.size()>{});
+}
 
-    return static_cast<int>(!test_single_with_fixture<Klass>(
-        test_suite, fn_name, std::forward<Method>(fn)));
+inline constexpr std::string_view constexpr_failure =
+    "ERROR: Not a constant expression. An assertion failed at compile time, "
+    "or the test calls something that isn't constexpr\n";
+
+// Reports the baked outcomes like tests that ran, without running anything
+template <testsuite Suite, test_list Tests, size_t N>
+int report_constexpr(Suite &test_suite, const Tests &tests,
+                     const std::array<bool, N> &passed) {
+  int fail_count = 0;
+  for (const size_t i : selected_indices(tests)) {
+    if (stopped_early()) {
+      break;
+    }
+
+    const TestResult result{tests.name(i), passed[i],
+                            passed[i] ? std::string_view{} : constexpr_failure};
+    record_result(test_suite, result);
+    fail_count += static_cast<int>(not result.passed);
   }
+
+  return fail_count;
+}
+
+} // namespace detail
+
+// Reports the tests that passed at compile time from the baked table, and
+// runs every other one. A failed constexpr test runs again as well, so its
+// report has the assertion message.
+template <detail::testsuite Suite, detail::test_list Tests, size_t N>
+int run_tests_auto(Suite &test_suite, const Tests &tests,
+                   const std::array<bool, N> &constant) {
+  const detail::FixtureScope<detail::list_fixture_t<Tests>> fixture_scope;
+  const auto suite_end = detail::suite_deadline();
+
+  int fail_count = 0;
+  for (const size_t i : detail::selected_indices(tests)) {
+    if (detail::stopped_early()) {
+      break;
+    }
+
+    const auto result =
+        constant[i] ? TestResult{tests.name(i), true}
+                    : detail::run_serial_test(
+                          tests.name(i), [&tests, i]() { tests.invoke(i); },
+                          detail::test_deadline(suite_end));
+    detail::record_result(test_suite, result);
+
+    fail_count += static_cast<int>(not result.passed);
+  }
+
+  return fail_count;
 }
 
 #define TEST_ALL(...)                                                          \
   []() {                                                                       \
+    static constexpr auto lambda_internal_tests =                              \
+        testing::detail::make_table(#__VA_ARGS__, __VA_ARGS__);                \
     testing::TestSuite lambda_internal_suite;                                  \
     auto lambda_internal_fail_c =                                              \
-        testing::test_all(lambda_internal_suite, #__VA_ARGS__, __VA_ARGS__);   \
+        testing::run_tests(lambda_internal_suite, lambda_internal_tests);      \
     lambda_internal_suite.report();                                            \
     return testing::TestInfo{std::move(lambda_internal_suite),                 \
                              lambda_internal_fail_c};                          \
@@ -256,9 +1307,12 @@ template <detail::testfixture Klass, detail::testsuite Suite, typename Method,
 
 #define TEST_ALL_FIXTURE(klass, ...)                                           \
   []() {                                                                       \
+    static constexpr auto lambda_internal_tests =                              \
+        testing::detail::make_fixture_table<klass>(#__VA_ARGS__,               \
+                                                   __VA_ARGS__);               \
     testing::TestSuite lambda_internal_suite;                                  \
-    auto lambda_internal_fail_c = testing::test_all_with_fixture<klass>(       \
-        lambda_internal_suite, #__VA_ARGS__, __VA_ARGS__);                     \
+    auto lambda_internal_fail_c =                                              \
+        testing::run_tests(lambda_internal_suite, lambda_internal_tests);      \
     lambda_internal_suite.report();                                            \
     return testing::TestInfo{std::move(lambda_internal_suite),                 \
                              lambda_internal_fail_c};                          \
@@ -266,37 +1320,178 @@ template <detail::testfixture Klass, detail::testsuite Suite, typename Method,
 
 #define TEST_ALL_SUITE(suite, ...)                                             \
   [&suite]() {                                                                 \
+    static constexpr auto lambda_internal_tests =                              \
+        testing::detail::make_table(#__VA_ARGS__, __VA_ARGS__);                \
     auto lambda_internal_fail_c =                                              \
-        testing::test_all(suite, #__VA_ARGS__, __VA_ARGS__);                   \
+        testing::run_tests(suite, lambda_internal_tests);                      \
     suite.report();                                                            \
-    return testing::TestInfo{suite, lambda_internal_fail_c};                   \
+    return testing::TestInfo<decltype(suite) &>{suite,                         \
+                                                lambda_internal_fail_c};       \
   }()
 
 #define TEST_ALL_SUITE_FIXTURE(suite, klass, ...)                              \
   [&suite]() {                                                                 \
-    auto lambda_internal_fail_c = testing::test_all_with_fixture<klass>(       \
-        suite, #__VA_ARGS__, __VA_ARGS__);                                     \
+    static constexpr auto lambda_internal_tests =                              \
+        testing::detail::make_fixture_table<klass>(#__VA_ARGS__,               \
+                                                   __VA_ARGS__);               \
+    auto lambda_internal_fail_c =                                              \
+        testing::run_tests(suite, lambda_internal_tests);                      \
+    suite.report();                                                            \
+    return testing::TestInfo<decltype(suite) &>{suite,                         \
+                                                lambda_internal_fail_c};       \
+  }()
+
+#define TEST_ALL_PARALLEL(...)                                                 \
+  []() {                                                                       \
+    static constexpr auto lambda_internal_tests =                              \
+        testing::detail::make_table(#__VA_ARGS__, __VA_ARGS__);                \
+    testing::TestSuite lambda_internal_suite;                                  \
+    auto lambda_internal_fail_c = testing::run_tests_parallel(                 \
+        lambda_internal_suite, lambda_internal_tests);                         \
+    lambda_internal_suite.report();                                            \
+    return testing::TestInfo{std::move(lambda_internal_suite),                 \
+                             lambda_internal_fail_c};                          \
+  }()
+
+#define TEST_ALL_FIXTURE_PARALLEL(klass, ...)                                  \
+  []() {                                                                       \
+    static constexpr auto lambda_internal_tests =                              \
+        testing::detail::make_fixture_table<klass>(#__VA_ARGS__,               \
+                                                   __VA_ARGS__);               \
+    testing::TestSuite lambda_internal_suite;                                  \
+    auto lambda_internal_fail_c = testing::run_tests_parallel(                 \
+        lambda_internal_suite, lambda_internal_tests);                         \
+    lambda_internal_suite.report();                                            \
+    return testing::TestInfo{std::move(lambda_internal_suite),                 \
+                             lambda_internal_fail_c};                          \
+  }()
+
+#define TEST_ALL_SUITE_PARALLEL(suite, ...)                                    \
+  [&suite]() {                                                                 \
+    static constexpr auto lambda_internal_tests =                              \
+        testing::detail::make_table(#__VA_ARGS__, __VA_ARGS__);                \
+    auto lambda_internal_fail_c =                                              \
+        testing::run_tests_parallel(suite, lambda_internal_tests);             \
+    suite.report();                                                            \
+    return testing::TestInfo<decltype(suite) &>{suite,                         \
+                                                lambda_internal_fail_c};       \
+  }()
+
+#define TEST_ALL_SUITE_FIXTURE_PARALLEL(suite, klass, ...)                     \
+  [&suite]() {                                                                 \
+    static constexpr auto lambda_internal_tests =                              \
+        testing::detail::make_fixture_table<klass>(#__VA_ARGS__,               \
+                                                   __VA_ARGS__);               \
+    auto lambda_internal_fail_c =                                              \
+        testing::run_tests_parallel(suite, lambda_internal_tests);             \
     suite.report();                                                            \
-    return testing::TestInfo{suite, lambda_internal_fail_c};                   \
+    return testing::TestInfo<decltype(suite) &>{suite,                         \
+                                                lambda_internal_fail_c};       \
   }()
 
 #define TEST_ALL_CONSTEXPR(...)                                                \
   []() {                                                                       \
-    constexpr testing::detail::ConstexprTestSuite lambda_internal_suite;       \
-    constexpr auto lambda_internal_fail_c =                                    \
-        testing::test_all(lambda_internal_suite, #__VA_ARGS__, __VA_ARGS__);   \
+    static constexpr auto lambda_internal_tests =                              \
+        testing::detail::make_table(#__VA_ARGS__, __VA_ARGS__);                \
+    static constexpr auto lambda_internal_results =                            \
+        testing::detail::evaluate_constexpr<lambda_internal_tests>();          \
+    testing::TestSuite lambda_internal_suite;                                  \
+    auto lambda_internal_fail_c =                                              \
+        testing::detail::report_constexpr(                                     \
+            lambda_internal_suite, lambda_internal_tests,                      \
+            lambda_internal_results);                                          \
     lambda_internal_suite.report();                                            \
-    return testing::TestInfo{lambda_internal_suite, lambda_internal_fail_c};   \
+    return testing::TestInfo{std::move(lambda_internal_suite),                 \
+                             lambda_internal_fail_c};                          \
   }()
 
 #define TEST_ALL_FIXTURE_CONSTEXPR(klass, ...)                                 \
   []() {                                                                       \
-    constexpr testing::detail::ConstexprTestSuite lambda_internal_suite;       \
-    constexpr auto lambda_internal_fail_c =                                    \
-        testing::test_all_with_fixture<klass>(lambda_internal_suite,           \
-                                              #__VA_ARGS__, __VA_ARGS__);      \
+    static constexpr auto lambda_internal_tests =                              \
+        testing::detail::make_fixture_table<klass>(#__VA_ARGS__,               \
+                                                   __VA_ARGS__);               \
+    static constexpr auto lambda_internal_results =                            \
+        testing::detail::evaluate_constexpr<lambda_internal_tests>();          \
+    testing::TestSuite lambda_internal_suite;                                  \
+    auto lambda_internal_fail_c =                                              \
+        testing::detail::report_constexpr(                                     \
+            lambda_internal_suite, lambda_internal_tests,                      \
+            lambda_internal_results);                                          \
+    lambda_internal_suite.report();                                            \
+    return testing::TestInfo{std::move(lambda_internal_suite),                 \
+                             lambda_internal_fail_c};                          \
+  }()
+
+// Like TEST_ALL, but tests that can be constant evaluated are checked while
+// compiling and only reported at runtime
+#define TEST_ALL_AUTO(...)                                                     \
+  []() {                                                                       \
+    static constexpr auto lambda_internal_tests =                              \
+        testing::detail::make_table(#__VA_ARGS__, __VA_ARGS__);                \
+    static constexpr auto lambda_internal_constant =                           \
+        testing::detail::probe_constexpr<lambda_internal_tests>();             \
+    testing::TestSuite lambda_internal_suite;                                  \
+    auto lambda_internal_fail_c =                                              \
+        testing::run_tests_auto(lambda_internal_suite, lambda_internal_tests,  \
+                                lambda_internal_constant);                     \
     lambda_internal_suite.report();                                            \
-    return testing::TestInfo{lambda_internal_suite, lambda_internal_fail_c};   \
+    return testing::TestInfo{std::move(lambda_internal_suite),                 \
+                             lambda_internal_fail_c};                          \
+  }()
+
+#define TEST_ALL_FIXTURE_AUTO(klass, ...)                                      \
+  []() {                                                                       \
+    static constexpr auto lambda_internal_tests =                              \
+        testing::detail::make_fixture_table<klass>(#__VA_ARGS__,               \
+                                                   __VA_ARGS__);               \
+    static constexpr auto lambda_internal_constant =                           \
+        testing::detail::probe_constexpr<lambda_internal_tests>();             \
+    testing::TestSuite lambda_internal_suite;                                  \
+    auto lambda_internal_fail_c =                                              \
+        testing::run_tests_auto(lambda_internal_suite, lambda_internal_tests,  \
+                                lambda_internal_constant);                     \
+    lambda_internal_suite.report();                                            \
+    return testing::TestInfo{std::move(lambda_internal_suite),                 \
+                             lambda_internal_fail_c};                          \
+  }()
+
+// Runs every test registered with TEST_CASE
+#define TEST_ALL_REGISTERED()                                                  \
+  []() {                                                                       \
+    testing::TestSuite lambda_internal_suite;                                  \
+    auto lambda_internal_fail_c =                                              \
+        testing::run_tests(lambda_internal_suite, testing::registry());        \
+    lambda_internal_suite.report();                                            \
+    return testing::TestInfo{std::move(lambda_internal_suite),                 \
+                             lambda_internal_fail_c};                          \
+  }()
+
+#define TEST_ALL_REGISTERED_PARALLEL()                                         \
+  []() {                                                                       \
+    testing::TestSuite lambda_internal_suite;                                  \
+    auto lambda_internal_fail_c = testing::run_tests_parallel(                 \
+        lambda_internal_suite, testing::registry());                           \
+    lambda_internal_suite.report();                                            \
+    return testing::TestInfo{std::move(lambda_internal_suite),                 \
+                             lambda_internal_fail_c};                          \
+  }()
+
+#define TEST_ALL_SUITE_REGISTERED(suite)                                       \
+  [&suite]() {                                                                 \
+    auto lambda_internal_fail_c =                                              \
+        testing::run_tests(suite, testing::registry());                        \
+    suite.report();                                                            \
+    return testing::TestInfo<decltype(suite) &>{suite,                         \
+                                                lambda_internal_fail_c};       \
+  }()
+
+#define TEST_ALL_SUITE_REGISTERED_PARALLEL(suite)                              \
+  [&suite]() {                                                                 \
+    auto lambda_internal_fail_c =                                              \
+        testing::run_tests_parallel(suite, testing::registry());               \
+    suite.report();                                                            \
+    return testing::TestInfo<decltype(suite) &>{suite,                         \
+                                                lambda_internal_fail_c};       \
   }()
 
 } // namespace testing
\ No newline at end of file
@@ -0,0 +1,149 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <deque>
+#include <functional>
+#include <future>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <type_traits>
+#include <vector>
+
+namespace testing::detail {
+
+inline size_t default_parallelism() {
+  return std::max<size_t>(std::thread::hardware_concurrency(), 1);
+}
+
+// Work-stealing thread pool. Every worker owns a queue and pops from its back,
+// so work it submits itself stays hot. Idle workers steal from the front of
+// the other queues. Sleeping happens only when all queues are empty.
+class ThreadPool {
+public:
+  explicit ThreadPool(size_t thread_count = default_parallelism())
+      : queues(std::max<size_t>(thread_count, 1)) {
+    workers.reserve(queues.size());
+    for (size_t i = 0; i < queues.size(); ++i) {
+      workers.emplace_back([this, i]() { work(i); });
+    }
+  }
+
+  ThreadPool(const ThreadPool &) = delete;
+  ThreadPool(ThreadPool &&) = delete;
+  ThreadPool &operator=(const ThreadPool &) = delete;
+  ThreadPool &operator=(ThreadPool &&) = delete;
+
+  ~ThreadPool() {
+    {
+      std::lock_guard lock{sleep_mutex};
+      stopping = true;
+    }
+    wakeup.notify_all();
+
+    for (auto &worker : workers) {
+      worker.join();
+    }
+  }
+
+  template <typename Fn>
+  std::future<std::invoke_result_t<Fn>> submit(Fn &&fn) {
+    using Result = std::invoke_result_t<Fn>;
+
+    // std::function needs a copyable target, so share the packaged_task
+    auto task =
+        std::make_shared<std::packaged_task<Result()>>(std::forward<Fn>(fn));
+    auto future = task->get_future();
+
+    push([task = std::move(task)]() { (*task)(); });
+
+    return future;
+  }
+
+  [[nodiscard]] size_t size() const { return workers.size(); }
+
+private:
+  struct Queue {
+    std::mutex mutex{};
+    std::deque<std::function<void()>> tasks{};
+  };
+
+  void push(std::function<void()> task) {
+    // Tasks submitted from one of our workers go to its own queue, others are
+    // distributed round-robin.
+    size_t index = (current_pool == this)
+                       ? current_index
+                       : next_queue.fetch_add(1) % queues.size();
+
+    {
+      std::lock_guard lock{queues[index].mutex};
+      queues[index].tasks.push_back(std::move(task));
+    }
+
+    {
+      std::lock_guard lock{sleep_mutex};
+      pending += 1;
+    }
+    wakeup.notify_one();
+  }
+
+  bool take(size_t index, std::function<void()> &task) {
+    {
+      auto &own = queues[index];
+      std::lock_guard lock{own.mutex};
+      if (not own.tasks.empty()) {
+        task = std::move(own.tasks.back());
+        own.tasks.pop_back();
+        return true;
+      }
+    }
+
+    for (size_t offset = 1; offset < queues.size(); ++offset) {
+      auto &victim = queues[(index + offset) % queues.size()];
+      std::lock_guard lock{victim.mutex};
+      if (not victim.tasks.empty()) {
+        task = std::move(victim.tasks.front());
+        victim.tasks.pop_front();
+        return true;
+      }
+    }
+
+    return false;
+  }
+
+  void work(size_t index) {
+    current_pool = this;
+    current_index = index;
+
+    while (true) {
+      std::function<void()> task;
+      if (take(index, task)) {
+        pending -= 1;
+        task();
+        continue;
+      }
+
+      std::unique_lock lock{sleep_mutex};
+      wakeup.wait(lock, [this]() { return stopping || pending > 0; });
+      if (stopping && pending == 0) {
+        return;
+      }
+    }
+  }
+
+  inline static thread_local const ThreadPool *current_pool = nullptr;
+  inline static thread_local size_t current_index = 0;
+
+  std::vector<Queue> queues;
+  std::vector<std::thread> workers{};
+  std::atomic<size_t> next_queue{0};
+  std::atomic<size_t> pending{0};
+  std::mutex sleep_mutex{};
+  std::condition_variable wakeup{};
+  bool stopping = false;
+};
+
+} // namespace testing::detail
@@ -0,0 +1,131 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <type_traits>
+#include <utility>
+
+#include "options.hpp"
+
+namespace testing::detail {
+
+constexpr auto no_deadline = std::chrono::steady_clock::time_point::max();
+
+// Deadline of a test list that starts now
+constexpr std::chrono::steady_clock::time_point suite_deadline() {
+  if (std::is_constant_evaluated() || options().suite_timeout.count() <= 0) {
+    return no_deadline;
+  }
+  return std::chrono::steady_clock::now() + options().suite_timeout;
+}
+
+// Deadline of a test that starts now, which can't be after its suite's
+constexpr std::chrono::steady_clock::time_point
+test_deadline(std::chrono::steady_clock::time_point suite_end = no_deadline) {
+  if (std::is_constant_evaluated() || options().test_timeout.count() <= 0) {
+    return suite_end;
+  }
+  return std::min(std::chrono::steady_clock::now() + options().test_timeout,
+                  suite_end);
+}
+
+// Threads of tests that timed out and may still be running. Static
+// destructors at exit would destroy what they use.
+inline std::atomic<size_t> &abandoned_threads() {
+  static std::atomic<size_t> count{0};
+  return count;
+}
+
+// Runs tasks on its own thread, so the calling thread can stop waiting for a
+// task that doesn't finish in time. Such a task keeps its thread, which is
+// abandoned, and a new thread takes over for the next tasks.
+class Executor {
+public:
+  Executor() = default;
+  Executor(const Executor &) = delete;
+  Executor(Executor &&) = delete;
+  Executor &operator=(const Executor &) = delete;
+  Executor &operator=(Executor &&) = delete;
+
+  ~Executor() {
+    {
+      std::lock_guard lock{state->mutex};
+      state->stopping = true;
+    }
+    state->wakeup.notify_all();
+    thread.join();
+  }
+
+  // Returns false if the deadline passed before the task finished
+  bool run_until(std::function<void()> task,
+                 std::chrono::steady_clock::time_point deadline) {
+    std::unique_lock lock{state->mutex};
+    state->task = std::move(task);
+    state->done = false;
+    state->wakeup.notify_all();
+
+    if (state->wakeup.wait_until(lock, deadline,
+                                 [this]() { return state->done; })) {
+      return true;
+    }
+
+    state->stopping = true;
+    lock.unlock();
+    state->wakeup.notify_all();
+
+    thread.detach();
+    abandoned_threads().fetch_add(1);
+    state = std::make_shared<State>();
+    thread = std::thread{work, state};
+    return false;
+  }
+
+private:
+  struct State {
+    std::mutex mutex{};
+    std::condition_variable wakeup{};
+    std::function<void()> task{};
+    bool done = false;
+    bool stopping = false;
+  };
+
+  // Shares the state, so an abandoned thread never refers to the executor
+  static void work(std::shared_ptr<State> state) {
+    std::unique_lock lock{state->mutex};
+    while (true) {
+      state->wakeup.wait(lock, [&state]() {
+        return state->stopping || state->task != nullptr;
+      });
+      if (state->task == nullptr) {
+        return;
+      }
+
+      auto task = std::move(state->task);
+      state->task = nullptr;
+
+      lock.unlock();
+      task();
+      lock.lock();
+
+      state->done = true;
+      state->wakeup.notify_all();
+    }
+  }
+
+  std::shared_ptr<State> state = std::make_shared<State>();
+  std::thread thread{work, state};
+};
+
+// Every thread that runs tests with a deadline has one executor
+inline Executor &executor() {
+  thread_local Executor instance;
+  return instance;
+}
+
+} // namespace testing::detail
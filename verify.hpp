@@ -1,10 +1,29 @@
 #pragma once
 
+#include "asserts.hpp"
 #include "concepts.hpp"
+#include "config.hpp"
 #include <cstddef>
+#include <experimental/source_location>
+#include <stdexcept>
 
 namespace testing {
 
+namespace detail {
+
+TESTING_FAIL_NORETURN inline void
+verify_failed(const std::experimental::source_location location =
+                  std::experimental::source_location::current()) {
+#ifdef TESTING_NO_EXCEPTIONS
+  fail(location, "VERIFY: Lhs != rhs");
+#else
+  (void)location;
+  throw std::invalid_argument("Lhs != rhs");
+#endif
+}
+
+} // namespace detail
+
 template <typename T> struct Verify {
   constexpr explicit Verify(T _val) : val(std::move(_val)) {}
   T val;
@@ -31,7 +50,7 @@ template <typename T, typename Other>
 requires std::equality_comparable_with<T, Other> constexpr Other
 operator&&(Other &&actual, const Verify<T> &expected) {
   if (actual != expected.val) {
-    throw std::invalid_argument("Lhs != rhs");
+    detail::verify_failed();
   }
 
   // Since c++20, rvalue refs are automatically moved as well.
@@ -44,7 +63,7 @@ template <typename T, typename Other>
 requires std::equality_comparable_with<T, Other> constexpr Other
 operator&&(const Verify<T> &expected, Other &&actual) {
   if (actual != expected.val) {
-    throw std::invalid_argument("Lhs != rhs");
+    detail::verify_failed();
   }
 
   return actual;
@@ -54,7 +73,7 @@ template <typename T, typename Other>
 requires std::equality_comparable_with<T, Other> constexpr Other
 operator^(const Verify<T> &expected, Other &&actual) {
   if (actual == expected.val) {
-    throw std::invalid_argument("Lhs != rhs");
+    detail::verify_failed();
   }
 
   return actual;
@@ -64,7 +83,7 @@ template <typename T, typename Other>
 requires std::equality_comparable_with<T, Other> constexpr Other
 operator^(Other &&actual, const Verify<T> &expected) {
   if (actual == expected.val) {
-    throw std::invalid_argument("Lhs != rhs");
+    detail::verify_failed();
   }
 
   return actual;
@@ -74,7 +93,7 @@ template <typename T, typename Other>
 requires std::equality_comparable_with<T, Other> constexpr Other
 v(Other &&actual, T &&expected) {
   if (actual != std::forward<T>(expected)) {
-    throw std::invalid_argument("Lhs != rhs");
+    detail::verify_failed();
   }
 
   return actual;
@@ -84,7 +103,7 @@ template <typename T, typename Other>
 requires std::equality_comparable_with<T, Other> constexpr Other
 vn(Other &&actual, T &&expected) {
   if (actual == std::forward<T>(expected)) {
-    throw std::invalid_argument("Lhs != rhs");
+    detail::verify_failed();
   }
 
   return actual;